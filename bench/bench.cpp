@@ -0,0 +1,710 @@
+#include "bench.h"
+#include "bench_export.h"
+#include "bench_raw.h"
+#include <xlua_state.h>
+#include <stdlib.h>
+#include <functional>
+#include <memory>
+#include <new>
+
+uint64_t AllocCounter::count = 0;
+
+void* operator new(size_t size) {
+    ++AllocCounter::count;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+namespace {
+    lua_Alloc s_alloc = nullptr;
+    void* s_alloc_ud = nullptr;
+
+    void* CountAlloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+        if (nsize)
+            ++AllocCounter::count;
+        return s_alloc(s_alloc_ud, ptr, osize, nsize);
+    }
+}
+
+void AllocCounter::Hook(lua_State* l) {
+    s_alloc = lua_getallocf(l, &s_alloc_ud);
+    lua_setallocf(l, &CountAlloc, nullptr);
+}
+
+static const int kLoop = 1000;    // operations of each call
+
+static const char* kScript = R"(
+    function bench_empty(n)
+        for i = 1, n do end
+    end
+
+    function bench_var(o, n)
+        for i = 1, n do o.a = o.a + 1 end
+    end
+
+    function bench_get(o, n)
+        local s = 0
+        for i = 1, n do s = s + o.c end
+        return s
+    end
+
+    function bench_call_0(o, n)
+        local s = 0
+        for i = 1, n do s = s + o:Get() end
+        return s
+    end
+
+    function bench_call_3(o, n)
+        local s = 0
+        for i = 1, n do s = s + o:Sum3(i, 2, 3) end
+        return s
+    end
+
+    function bench_call_6(o, n)
+        local s = 0
+        for i = 1, n do s = s + o:Sum6(i, 2, 3, 4, 5, 6) end
+        return s
+    end
+
+    function bench_std_function(f, n)
+        local s = 0
+        for i = 1, n do s = s + f(i) end
+        return s
+    end
+
+    function bench_index(v, c, n)
+        local s = 0
+        for i = 1, n do s = s + v[i % c + 1] end
+        return s
+    end
+
+    function bench_pairs(v)
+        local s = 0
+        for _, x in pairs(v) do s = s + x end
+        return s
+    end
+
+    function bench_sum_table(t)
+        local s = 0
+        for i = 1, #t do s = s + t[i] end
+        return s
+    end
+
+    function bench_to_table(v)
+        return bench_sum_table(xlua.ToTable(v))
+    end
+
+    function bench_add(a, b)
+        return a + b
+    end
+)";
+
+/* call the global function by lua c api, push pushes nargs parameters */
+template <typename Fn>
+static lua_Integer RawCall(lua_State* l, const char* global, int nargs, Fn&& push) {
+    lua_getglobal(l, global);
+    push();
+    if (lua_pcall(l, nargs, 1, 0) != LUA_OK) {
+        printf("call %s failed: %s\n", global, lua_tostring(l, -1));
+        lua_pop(l, 1);
+        return 0;
+    }
+
+    lua_Integer ret = lua_tointeger(l, -1);
+    lua_pop(l, 1);
+    return ret;
+}
+
+/* container parameter converted from lua table */
+static double SumVector(const std::vector<double>& vec) {
+    double sum = 0;
+    for (double v : vec)
+        sum += v;
+    return sum;
+}
+
+static size_t MapSize(const std::unordered_map<std::string, float>& map) {
+    return map.size();
+}
+
+/* hand-written int(lua_State*) shims of the table conversion */
+static int RawSumVector(lua_State* l) {
+    std::vector<double> vec;
+    size_t len = lua_rawlen(l, 1);
+    vec.reserve(len);
+    for (size_t i = 1; i <= len; ++i) {
+        lua_rawgeti(l, 1, (lua_Integer)i);
+        vec.push_back(lua_tonumber(l, -1));
+        lua_pop(l, 1);
+    }
+    lua_pushnumber(l, SumVector(vec));
+    return 1;
+}
+
+static int RawMapSize(lua_State* l) {
+    std::unordered_map<std::string, float> map;
+    lua_pushnil(l);
+    while (lua_next(l, 1)) {
+        size_t len = 0;
+        const char* key = lua_tolstring(l, -2, &len);
+        map.emplace(std::string(key, len), (float)lua_tonumber(l, -1));
+        lua_pop(l, 1);
+    }
+    lua_pushinteger(l, (lua_Integer)MapSize(map));
+    return 1;
+}
+
+/* usage: bench_xlua [filter] [-csv] [-ms=time of each case] */
+int main(int argc, char* argv[]) {
+    const char* filter = nullptr;
+    bool csv = false;
+    uint64_t min_ms = 200;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-csv") == 0)
+            csv = true;
+        else if (strncmp(argv[i], "-ms=", 4) == 0)
+            min_ms = (uint64_t)atoi(argv[i] + 4);
+        else
+            filter = argv[i];
+    }
+
+    xlua::State* s = xlua::Create(nullptr);
+    AllocCounter::Hook(s->GetLuaState());
+    raw::Register(s->GetLuaState());
+    if (!s->DoString(kScript, "bench")) {
+        printf("load bench script failed\n");
+        return 1;
+    }
+
+#ifdef NDEBUG
+    const char* build = "release";
+#else
+    const char* build = "debug";
+#endif // NDEBUG
+    if (!csv)
+        printf("xlua bench, build:%s, lud:%d, pool alloc:%d\n", build, XLUA_ENABLE_LUD_OPTIMIZE, XLUA_ENABLE_POOL_ALLOC);
+
+    Bench bench(filter, csv, min_ms);
+    bench.Header();
+
+    lua_State* l = s->GetLuaState();
+    BenchObj obj;
+    std::string str = "xlua bench string";
+
+    /* push/load */
+    bench.Run("push_load_int", kLoop, [s]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push(i);
+            sum += s->Get<int>(-1);
+            s->PopTop(1);
+        }
+        return sum;
+    }, [l]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            lua_pushinteger(l, i);
+            sum += (int)lua_tointeger(l, -1);
+            lua_pop(l, 1);
+        }
+        return sum;
+    });
+
+    bench.Run("push_load_double", kLoop, [s]() {
+        double sum = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push(i * 0.5);
+            sum += s->Get<double>(-1);
+            s->PopTop(1);
+        }
+        return sum;
+    }, [l]() {
+        double sum = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            lua_pushnumber(l, i * 0.5);
+            sum += lua_tonumber(l, -1);
+            lua_pop(l, 1);
+        }
+        return sum;
+    });
+
+    bench.Run("push_load_cstr", kLoop, [s]() {
+        size_t len = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push("xlua bench string");
+            len += strlen(s->Get<const char*>(-1));
+            s->PopTop(1);
+        }
+        return len;
+    }, [l]() {
+        size_t len = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            lua_pushstring(l, "xlua bench string");
+            len += strlen(lua_tostring(l, -1));
+            lua_pop(l, 1);
+        }
+        return len;
+    });
+
+    bench.Run("push_load_std_string", kLoop, [s, &str]() {
+        size_t len = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push(str);
+            len += s->Get<std::string>(-1).size();
+            s->PopTop(1);
+        }
+        return len;
+    }, [l, &str]() {
+        size_t len = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            lua_pushlstring(l, str.c_str(), str.size());
+            size_t n = 0;
+            const char* p = lua_tolstring(l, -1, &n);
+            len += std::string(p, n).size();
+            lua_pop(l, 1);
+        }
+        return len;
+    });
+
+    /* table field read, the c string key is hashed and interned on every access */
+    static const xlua::Key k_field("config_value");
+    s->NewTable();
+    s->SetField(-1, "config_value", 1);
+    bench.Run("get_field_cstr", kLoop, [s]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i)
+            sum += s->GetField<int>(-1, "config_value");
+        return sum;
+    }, [l]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            lua_getfield(l, -1, "config_value");
+            sum += (int)lua_tointeger(l, -1);
+            lua_pop(l, 1);
+        }
+        return sum;
+    });
+
+    bench.Run("get_field_key", kLoop, [s]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i)
+            sum += s->GetField<int>(-1, k_field);
+        return sum;
+    }, [l]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            lua_getfield(l, -1, "config_value");
+            sum += (int)lua_tointeger(l, -1);
+            lua_pop(l, 1);
+        }
+        return sum;
+    });
+    s->PopTop(1);
+
+    /* table traversal, the iterator builds Variant pairs, ForEach loads in place */
+    s->NewTable();
+    for (int i = 1; i <= kLoop; ++i)
+        s->SetField(-1, i, i);
+    auto table = s->Get<xlua::Table>(-1);
+    auto raw_traverse = [l]() {
+        int64_t sum = 0;
+        lua_pushnil(l);
+        while (lua_next(l, -2)) {
+            sum += lua_tointeger(l, -1);
+            lua_pop(l, 1);
+        }
+        return sum;
+    };
+
+    bench.Run("table_iterator", kLoop, [&table]() {
+        int64_t sum = 0;
+        for (const auto& pair : table)
+            sum += pair.second.ToInt();
+        return sum;
+    }, raw_traverse);
+
+    bench.Run("table_foreach", kLoop, [&table]() {
+        int64_t sum = 0;
+        table.ForEach<int, int>([&sum](int key, int value) { sum += value; });
+        return sum;
+    }, raw_traverse);
+    table = nullptr;
+    s->PopTop(1);
+
+    /* string values longer than the small string buffer, refered instead of copied */
+    s->NewTable();
+    for (int i = 1; i <= kLoop; ++i)
+        s->SetField(-1, i, std::string("a config string value of record ") + std::to_string(i));
+    table = s->Get<xlua::Table>(-1);
+    bench.Run("table_iterator_string", kLoop, [&table]() {
+        size_t len = 0;
+        table.ForEach([&len](const xlua::TableCursor& c) {
+            len += c.GetState()->GetVariant(c.GetValueIndex(), true).StrLen();
+        });
+        return len;
+    }, [l]() {
+        size_t len = 0;
+        lua_pushnil(l);
+        while (lua_next(l, -2)) {
+            size_t n = 0;
+            lua_tolstring(l, -1, &n);
+            len += n;
+            lua_pop(l, 1);
+        }
+        return len;
+    });
+    table = nullptr;
+    s->PopTop(1);
+
+    /* declared struct of config record, one traversal per record vs getfield per field */
+    xlua::Table records;
+    s->DoString(R"(
+        local records = {}
+        for i = 1, 1000 do
+            records[i] = {id = i, name = "record" .. i, x = i * 0.5, y = i * 2, level = i % 60, tags = {1, 2, 3, 4}}
+        end
+        return records
+    )", "bench_records", std::tie(records));
+    s->Push(records);
+    records = nullptr;
+    bench.Run("struct_load", kLoop, [s, l]() {
+        int64_t sum = 0;
+        for (int i = 1; i <= kLoop; ++i) {
+            lua_rawgeti(l, -1, i);
+            BenchRecord r = s->Get<BenchRecord>(-1);
+            sum += r.id + r.level + r.tags.size();
+            lua_pop(l, 1);
+        }
+        return sum;
+    }, [l]() {
+        int64_t sum = 0;
+        for (int i = 1; i <= kLoop; ++i) {
+            lua_rawgeti(l, -1, i);
+            BenchRecord r;
+            lua_getfield(l, -1, "id");
+            r.id = (int)lua_tointeger(l, -1);
+            lua_getfield(l, -2, "name");
+            r.name = lua_tostring(l, -1);
+            lua_getfield(l, -3, "x");
+            r.x = lua_tonumber(l, -1);
+            lua_getfield(l, -4, "y");
+            r.y = lua_tonumber(l, -1);
+            lua_getfield(l, -5, "level");
+            r.level = (int)lua_tointeger(l, -1);
+            lua_getfield(l, -6, "tags");
+            r.tags.resize(lua_rawlen(l, -1));
+            for (size_t t = 0; t < r.tags.size(); ++t) {
+                lua_rawgeti(l, -1, (lua_Integer)t + 1);
+                r.tags[t] = (int)lua_tointeger(l, -1);
+                lua_pop(l, 1);
+            }
+            lua_pop(l, 7);
+            sum += r.id + r.level + r.tags.size();
+        }
+        return sum;
+    });
+
+    BenchRecord record;
+    record.name = "record";
+    record.tags = {1, 2, 3, 4};
+    bench.Run("struct_push", kLoop, [s, &record]() {
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push(record);
+            s->PopTop(1);
+        }
+    }, [l, &record]() {
+        for (int i = 0; i < kLoop; ++i) {
+            lua_createtable(l, 0, 6);
+            lua_pushinteger(l, record.id);
+            lua_setfield(l, -2, "id");
+            lua_pushlstring(l, record.name.c_str(), record.name.size());
+            lua_setfield(l, -2, "name");
+            lua_pushnumber(l, record.x);
+            lua_setfield(l, -2, "x");
+            lua_pushnumber(l, record.y);
+            lua_setfield(l, -2, "y");
+            lua_pushinteger(l, record.level);
+            lua_setfield(l, -2, "level");
+            lua_createtable(l, (int)record.tags.size(), 0);
+            for (size_t t = 0; t < record.tags.size(); ++t) {
+                lua_pushinteger(l, record.tags[t]);
+                lua_rawseti(l, -2, (lua_Integer)t + 1);
+            }
+            lua_setfield(l, -2, "tags");
+            lua_pop(l, 1);
+        }
+    });
+    s->PopTop(1);
+
+    /* object pointer, light userdata if XLUA_ENABLE_LUD_OPTIMIZE else the cached full userdata
+     * the baseline is the raw light userdata
+    */
+    bench.Run("push_ptr", kLoop, [s, &obj]() {
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push(&obj);
+            s->PopTop(1);
+        }
+    }, [l, &obj]() {
+        for (int i = 0; i < kLoop; ++i) {
+            lua_pushlightuserdata(l, &obj);
+            lua_pop(l, 1);
+        }
+    });
+
+    s->Push(&obj);
+    lua_pushlightuserdata(l, &obj);
+    bench.Run("load_ptr", kLoop, [s]() {
+        BenchObj* p = nullptr;
+        for (int i = 0; i < kLoop; ++i)
+            p = s->Get<BenchObj*>(-2);
+        return p;
+    }, [l]() {
+        BenchObj* p = nullptr;
+        for (int i = 0; i < kLoop; ++i)
+            p = static_cast<BenchObj*>(lua_touserdata(l, -1));
+        return p;
+    });
+    s->PopTop(2);
+
+    /* smart pointer is always full userdata, the baseline is a userdata cached in a weak table */
+    auto shared = std::make_shared<BenchObj>();
+    s->Push(shared);
+    raw::PushObj(l, shared.get());
+    bench.Run("push_fullud_hit", kLoop, [s, &shared]() {
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push(shared);
+            s->PopTop(1);
+        }
+    }, [l, &shared]() {
+        for (int i = 0; i < kLoop; ++i) {
+            raw::PushObj(l, shared.get());
+            lua_pop(l, 1);
+        }
+    });
+
+    bench.Run("load_fullud", kLoop, [s]() {
+        BenchObj* p = nullptr;
+        for (int i = 0; i < kLoop; ++i)
+            p = s->Get<BenchObj*>(-2);
+        return p;
+    }, [l]() {
+        BenchObj* p = nullptr;
+        for (int i = 0; i < kLoop; ++i)
+            p = raw::ToObj(l, -1);
+        return p;
+    });
+    s->PopTop(2);
+
+    /* new userdata for every push, include the gc of the userdata */
+    std::vector<std::shared_ptr<BenchObj>> pool;
+    for (int i = 0; i < 64 * kLoop; ++i)
+        pool.push_back(std::make_shared<BenchObj>());
+    size_t next = 0;
+    bench.Run("push_fullud_miss", kLoop, [s, &pool, &next]() {
+        if (next == pool.size()) {
+            next = 0;
+            s->Gc();
+        }
+        for (int i = 0; i < kLoop; ++i) {
+            s->Push(pool[next++]);
+            s->PopTop(1);
+        }
+    }, [l, &pool, &next]() {
+        if (next == pool.size()) {
+            next = 0;
+            lua_gc(l, LUA_GCCOLLECT, 0);
+        }
+        for (int i = 0; i < kLoop; ++i) {
+            raw::PushObj(l, pool[next++].get());
+            lua_pop(l, 1);
+        }
+    });
+    s->Gc();
+
+    /* lua calls c++, the same lua loop with the xlua object and the raw userdata */
+    bench.Run("lua_empty_loop", kLoop, [s]() {
+        s->Call("bench_empty", std::tie(), kLoop);
+    });
+
+    bench.Run("member_var_get_set", kLoop, [s, &obj]() {
+        s->Call("bench_var", std::tie(), &obj, kLoop);
+    }, [l, &obj]() {
+        RawCall(l, "bench_var", 2, [l, &obj]() {
+            raw::PushObj(l, &obj);
+            lua_pushinteger(l, kLoop);
+        });
+    });
+
+    bench.Run("member_var_get_float", kLoop, [s, &obj]() {
+        s->Call("bench_get", std::tie(), &obj, kLoop);
+    }, [l, &obj]() {
+        RawCall(l, "bench_get", 2, [l, &obj]() {
+            raw::PushObj(l, &obj);
+            lua_pushinteger(l, kLoop);
+        });
+    });
+
+    bench.Run("member_call_0", kLoop, [s, &obj]() {
+        s->Call("bench_call_0", std::tie(), &obj, kLoop);
+    }, [l, &obj]() {
+        RawCall(l, "bench_call_0", 2, [l, &obj]() {
+            raw::PushObj(l, &obj);
+            lua_pushinteger(l, kLoop);
+        });
+    });
+
+    bench.Run("member_call_3", kLoop, [s, &obj]() {
+        s->Call("bench_call_3", std::tie(), &obj, kLoop);
+    }, [l, &obj]() {
+        RawCall(l, "bench_call_3", 2, [l, &obj]() {
+            raw::PushObj(l, &obj);
+            lua_pushinteger(l, kLoop);
+        });
+    });
+
+    bench.Run("member_call_6", kLoop, [s, &obj]() {
+        s->Call("bench_call_6", std::tie(), &obj, kLoop);
+    }, [l, &obj]() {
+        RawCall(l, "bench_call_6", 2, [l, &obj]() {
+            raw::PushObj(l, &obj);
+            lua_pushinteger(l, kLoop);
+        });
+    });
+
+    std::function<int(int)> func = [](int v) { return v + 1; };
+    bench.Run("lua_call_std_function", kLoop, [s, &func]() {
+        s->Call("bench_std_function", std::tie(), func, kLoop);
+    }, [l, &func]() {
+        RawCall(l, "bench_std_function", 2, [l, &func]() {
+            raw::PushFunction(l, &func);
+            lua_pushinteger(l, kLoop);
+        });
+    });
+
+    /* c++ calls lua */
+    auto lua_func = s->GetGlobal<std::function<int(int, int)>>("bench_add");
+    auto raw_add = [l](int i) {
+        return (int)RawCall(l, "bench_add", 2, [l, i]() {
+            lua_pushinteger(l, i);
+            lua_pushinteger(l, 1);
+        });
+    };
+
+    bench.Run("cpp_call_std_function", kLoop, [&lua_func]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i)
+            sum += lua_func(i, 1);
+        return sum;
+    }, [&raw_add]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i)
+            sum += raw_add(i);
+        return sum;
+    });
+
+    bench.Run("cpp_call_lua", kLoop, [s]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i) {
+            int ret = 0;
+            s->Call("bench_add", std::tie(ret), i, 1);
+            sum += ret;
+        }
+        return sum;
+    }, [&raw_add]() {
+        int sum = 0;
+        for (int i = 0; i < kLoop; ++i)
+            sum += raw_add(i);
+        return sum;
+    });
+
+    /* collection */
+    std::vector<int> vec(kLoop, 1);
+    bench.Run("collection_index", kLoop, [s, &vec]() {
+        s->Call("bench_index", std::tie(), &vec, (int)vec.size(), kLoop);
+    }, [l, &vec]() {
+        RawCall(l, "bench_index", 3, [l, &vec]() {
+            raw::PushVector(l, &vec);
+            lua_pushinteger(l, (lua_Integer)vec.size());
+            lua_pushinteger(l, kLoop);
+        });
+    });
+
+    bench.Run("collection_pairs", kLoop, [s, &vec]() {
+        s->Call("bench_pairs", std::tie(), &vec);
+    }, [l, &vec]() {
+        RawCall(l, "bench_pairs", 1, [l, &vec]() {
+            raw::PushVector(l, &vec);
+        });
+    });
+
+    /* bulk copy to a presized lua table, then scan the plain table */
+    bench.Run("collection_to_table", kLoop, [s, &vec]() {
+        int sum = 0;
+        s->Call("bench_to_table", std::tie(sum), &vec);
+        return sum;
+    }, [l, &vec]() {
+        return RawCall(l, "bench_sum_table", 1, [l, &vec]() {
+            lua_createtable(l, (int)vec.size(), 0);
+            for (size_t i = 0; i < vec.size(); ++i) {
+                lua_pushinteger(l, vec[i]);
+                lua_rawseti(l, -2, (lua_Integer)i + 1);
+            }
+        });
+    });
+
+    bench.Run("push_array", kLoop, [s, l, &vec]() {
+        s->PushArray(vec);
+        lua_pop(l, 1);
+    }, [l, &vec]() {
+        lua_createtable(l, (int)vec.size(), 0);
+        for (size_t i = 0; i < vec.size(); ++i) {
+            lua_pushinteger(l, vec[i]);
+            lua_rawseti(l, -2, (lua_Integer)i + 1);
+        }
+        lua_pop(l, 1);
+    });
+
+    /* lua table to container by value parameter, 100k elements */
+    static const int kTableLen = 100000;
+    xlua::Table numbers;
+    xlua::Table named;
+    s->DoString(R"(
+        local t, m = {}, {}
+        for i = 1, 100000 do
+            t[i] = i * 0.5
+            m["key" .. i] = i * 0.5
+        end
+        return t, m
+    )", "bench_tables", std::tie(numbers, named));
+    s->SetGlobal("bench_sum_vector", &SumVector);
+    s->SetGlobal("bench_map_size", &MapSize);
+    lua_register(l, "raw_sum_vector", &RawSumVector);
+    lua_register(l, "raw_map_size", &RawMapSize);
+
+    bench.Run("table_to_vector", kTableLen, [s, &numbers]() {
+        double sum = 0;
+        s->Call("bench_sum_vector", std::tie(sum), numbers);
+        return sum;
+    }, [s, l, &numbers]() {
+        return RawCall(l, "raw_sum_vector", 1, [s, &numbers]() { s->Push(numbers); });
+    });
+
+    bench.Run("table_to_unordered_map", kTableLen, [s, &named]() {
+        size_t size = 0;
+        s->Call("bench_map_size", std::tie(size), named);
+        return size;
+    }, [s, l, &named]() {
+        return RawCall(l, "raw_map_size", 1, [s, &named]() { s->Push(named); });
+    });
+    numbers = nullptr;
+    named = nullptr;
+
+    lua_func = nullptr;
+    s->Release();
+    return 0;
+}
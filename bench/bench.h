@@ -0,0 +1,127 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct lua_State;
+
+/* count the allocations of c++ heap and lua allocator */
+struct AllocCounter {
+    static uint64_t count;
+
+    /* count the lua allocations of the state */
+    static void Hook(lua_State* l);
+};
+
+/* self contained timing harness
+ * every case is calibrated to run about min_ms, the result is ns and allocations per operation
+ * the case with a raw lua c api baseline reports the xlua/raw time ratio
+*/
+class Bench {
+public:
+    struct Result {
+        std::string name;
+        double ns_op;
+        double allocs_op;
+        double raw_ns_op;       // 0 if no baseline
+        double raw_allocs_op;
+    };
+
+    struct Sample {
+        double ns_op;
+        double allocs_op;
+    };
+
+public:
+    Bench(const char* filter, bool csv, uint64_t min_ms) : filter_(filter), csv_(csv), min_ms_(min_ms) {}
+
+    /* fn runs ops operations each call */
+    template <typename Fn>
+    void Run(const char* name, uint64_t ops, Fn&& fn) {
+        if (filter_ && strstr(name, filter_) == nullptr)
+            return;
+
+        Sample sample = Sampling(ops, fn);
+        Result result{name, sample.ns_op, sample.allocs_op, 0, 0};
+        Print(result);
+        results_.push_back(result);
+    }
+
+    /* raw_fn is the hand-written lua c api equivalent of fn */
+    template <typename Fn, typename RawFn>
+    void Run(const char* name, uint64_t ops, Fn&& fn, RawFn&& raw_fn) {
+        if (filter_ && strstr(name, filter_) == nullptr)
+            return;
+
+        Sample raw = Sampling(ops, raw_fn);
+        Sample sample = Sampling(ops, fn);
+        Result result{name, sample.ns_op, sample.allocs_op, raw.ns_op, raw.allocs_op};
+        Print(result);
+        results_.push_back(result);
+    }
+
+    void Header() const {
+        if (csv_)
+            printf("name,ns_op,allocs_op,raw_ns_op,raw_allocs_op,ratio\n");
+        else
+            printf("%-32s %12s %12s %12s %12s %8s\n", "benchmark", "ns/op", "allocs/op", "raw ns/op", "raw allocs", "ratio");
+    }
+
+    inline const std::vector<Result>& GetResults() const { return results_; }
+
+private:
+    template <typename Fn>
+    Sample Sampling(uint64_t ops, Fn& fn) const {
+        fn();   // warm up
+        uint64_t calls = 1;
+        uint64_t ns = 0;
+        for (;;) {
+            ns = Measure(calls, fn);
+            if (ns >= min_ms_ * 1000000 / 10)
+                break;
+            calls *= 2;
+        }
+
+        calls = calls * min_ms_ * 1000000 / (ns ? ns : 1) + 1;
+        uint64_t allocs = AllocCounter::count;
+        ns = Measure(calls, fn);
+        allocs = AllocCounter::count - allocs;
+        return Sample{(double)ns / (calls * ops), (double)allocs / (calls * ops)};
+    }
+
+    template <typename Fn>
+    static uint64_t Measure(uint64_t calls, Fn& fn) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < calls; ++i)
+            fn();
+        auto end = std::chrono::steady_clock::now();
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    void Print(const Result& result) const {
+        if (result.raw_ns_op <= 0) {
+            if (csv_)
+                printf("%s,%.2f,%.3f,,,\n", result.name.c_str(), result.ns_op, result.allocs_op);
+            else
+                printf("%-32s %12.2f %12.3f %12s %12s %8s\n", result.name.c_str(), result.ns_op, result.allocs_op, "-", "-", "-");
+        } else {
+            double ratio = result.ns_op / result.raw_ns_op;
+            if (csv_)
+                printf("%s,%.2f,%.3f,%.2f,%.3f,%.2f\n", result.name.c_str(), result.ns_op, result.allocs_op,
+                    result.raw_ns_op, result.raw_allocs_op, ratio);
+            else
+                printf("%-32s %12.2f %12.3f %12.2f %12.3f %8.2f\n", result.name.c_str(), result.ns_op, result.allocs_op,
+                    result.raw_ns_op, result.raw_allocs_op, ratio);
+        }
+        fflush(stdout);
+    }
+
+private:
+    const char* filter_;
+    bool csv_;
+    uint64_t min_ms_;
+    std::vector<Result> results_;
+};
@@ -0,0 +1,25 @@
+/* generated by xlua_gen.py, do not edit */
+#include "bench_export.h"
+#include <xlua_export.h>
+
+XLUA_EXPORT_CLASS_BEGIN(BenchObj)
+XLUA_VARIATE(BenchObj::a)
+XLUA_VARIATE(BenchObj::b)
+XLUA_VARIATE(BenchObj::c)
+XLUA_FUNCTION(BenchObj::Get)
+XLUA_FUNCTION(BenchObj::Sum3)
+XLUA_FUNCTION(BenchObj::Sum6)
+XLUA_EXPORT_CLASS_END()
+
+XLUA_EXPORT_CLASS_BEGIN(BenchWeakObj)
+XLUA_VARIATE(BenchWeakObj::a)
+XLUA_EXPORT_CLASS_END()
+
+XLUA_EXPORT_STRUCT_BEGIN(BenchRecord)
+XLUA_FIELD(BenchRecord::id)
+XLUA_FIELD(BenchRecord::name)
+XLUA_FIELD(BenchRecord::x)
+XLUA_FIELD(BenchRecord::y)
+XLUA_FIELD(BenchRecord::level)
+XLUA_FIELD(BenchRecord::tags)
+XLUA_EXPORT_STRUCT_END()
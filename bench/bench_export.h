@@ -0,0 +1,34 @@
+#pragma once
+#include <xlua_def.h>
+#include <string>
+#include <vector>
+
+struct BenchObj {
+    int a = 0;
+    double b = 0;
+    float c = 0.5f;
+
+    int Get() const { return a; }
+    int Sum3(int x1, int x2, int x3) { return x1 + x2 + x3; }
+    int Sum6(int x1, int x2, int x3, int x4, int x5, int x6) { return x1 + x2 + x3 + x4 + x5 + x6; }
+};
+
+/* xlua weak object */
+struct BenchWeakObj {
+    XLUA_DECLARE_OBJ_INDEX;
+    int a = 0;
+};
+
+/* config record converted with lua table */
+struct BenchRecord {
+    int id = 0;
+    std::string name;
+    double x = 0;
+    double y = 0;
+    int level = 0;
+    std::vector<int> tags;
+};
+
+XLUA_DECLARE_CLASS(BenchObj);
+XLUA_DECLARE_CLASS(BenchWeakObj);
+XLUA_DECLARE_STRUCT(BenchRecord);
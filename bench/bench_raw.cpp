@@ -0,0 +1,162 @@
+#include "bench_raw.h"
+#include <lua.hpp>
+#include <string.h>
+
+namespace raw {
+    static const char* kObjMeta = "raw.BenchObj";
+    static const char* kVectorMeta = "raw.vector";
+    static const char kCacheKey = 0;    // registry key of the userdata cache
+
+    static BenchObj* CheckObj(lua_State* l, int index) {
+        return *static_cast<BenchObj**>(luaL_checkudata(l, index, kObjMeta));
+    }
+
+    static int Get(lua_State* l) {
+        lua_pushinteger(l, CheckObj(l, 1)->Get());
+        return 1;
+    }
+
+    static int Sum3(lua_State* l) {
+        auto* obj = CheckObj(l, 1);
+        lua_pushinteger(l, obj->Sum3((int)luaL_checkinteger(l, 2), (int)luaL_checkinteger(l, 3),
+            (int)luaL_checkinteger(l, 4)));
+        return 1;
+    }
+
+    static int Sum6(lua_State* l) {
+        auto* obj = CheckObj(l, 1);
+        lua_pushinteger(l, obj->Sum6((int)luaL_checkinteger(l, 2), (int)luaL_checkinteger(l, 3),
+            (int)luaL_checkinteger(l, 4), (int)luaL_checkinteger(l, 5),
+            (int)luaL_checkinteger(l, 6), (int)luaL_checkinteger(l, 7)));
+        return 1;
+    }
+
+    static int ObjIndex(lua_State* l) {
+        auto* obj = CheckObj(l, 1);
+        const char* key = luaL_checkstring(l, 2);
+        if (strcmp(key, "a") == 0)
+            lua_pushinteger(l, obj->a);
+        else if (strcmp(key, "b") == 0)
+            lua_pushnumber(l, obj->b);
+        else if (strcmp(key, "c") == 0)
+            lua_pushnumber(l, obj->c);
+        else
+            lua_rawget(l, lua_upvalueindex(1));    // methods
+        return 1;
+    }
+
+    static int ObjNewIndex(lua_State* l) {
+        auto* obj = CheckObj(l, 1);
+        const char* key = luaL_checkstring(l, 2);
+        if (strcmp(key, "a") == 0)
+            obj->a = (int)luaL_checkinteger(l, 3);
+        else if (strcmp(key, "b") == 0)
+            obj->b = luaL_checknumber(l, 3);
+        else if (strcmp(key, "c") == 0)
+            obj->c = (float)luaL_checknumber(l, 3);
+        else
+            return luaL_error(l, "unknown member %s", key);
+        return 0;
+    }
+
+    static std::vector<int>* CheckVector(lua_State* l, int index) {
+        return *static_cast<std::vector<int>**>(luaL_checkudata(l, index, kVectorMeta));
+    }
+
+    static int VectorIndex(lua_State* l) {
+        auto* vec = CheckVector(l, 1);
+        lua_Integer i = luaL_checkinteger(l, 2);
+        if (i < 1 || i > (lua_Integer)vec->size())
+            return luaL_error(l, "index is out of range");
+        lua_pushinteger(l, (*vec)[(size_t)i - 1]);
+        return 1;
+    }
+
+    static int VectorNext(lua_State* l) {
+        auto* vec = CheckVector(l, 1);
+        lua_Integer i = lua_isnil(l, 2) ? 0 : luaL_checkinteger(l, 2);
+        if (i >= (lua_Integer)vec->size())
+            return 0;
+        lua_pushinteger(l, i + 1);
+        lua_pushinteger(l, (*vec)[(size_t)i]);
+        return 2;
+    }
+
+    static int VectorPairs(lua_State* l) {
+        CheckVector(l, 1);
+        lua_pushcfunction(l, &VectorNext);
+        lua_pushvalue(l, 1);
+        lua_pushnil(l);
+        return 3;
+    }
+
+    static int CallFunction(lua_State* l) {
+        auto* func = static_cast<std::function<int(int)>*>(lua_touserdata(l, lua_upvalueindex(1)));
+        lua_pushinteger(l, (*func)((int)luaL_checkinteger(l, 1)));
+        return 1;
+    }
+
+    void Register(lua_State* l) {
+        luaL_newmetatable(l, kObjMeta);
+        lua_newtable(l);
+        lua_pushcfunction(l, &Get);
+        lua_setfield(l, -2, "Get");
+        lua_pushcfunction(l, &Sum3);
+        lua_setfield(l, -2, "Sum3");
+        lua_pushcfunction(l, &Sum6);
+        lua_setfield(l, -2, "Sum6");
+        lua_pushcclosure(l, &ObjIndex, 1);
+        lua_setfield(l, -2, "__index");
+        lua_pushcfunction(l, &ObjNewIndex);
+        lua_setfield(l, -2, "__newindex");
+        lua_pop(l, 1);
+
+        luaL_newmetatable(l, kVectorMeta);
+        lua_pushcfunction(l, &VectorIndex);
+        lua_setfield(l, -2, "__index");
+        lua_pushcfunction(l, &VectorPairs);
+        lua_setfield(l, -2, "__pairs");
+        lua_pop(l, 1);
+
+        // weak value cache: light userdata -> userdata
+        lua_newtable(l);
+        lua_newtable(l);
+        lua_pushstring(l, "v");
+        lua_setfield(l, -2, "__mode");
+        lua_setmetatable(l, -2);
+        lua_rawsetp(l, LUA_REGISTRYINDEX, &kCacheKey);
+    }
+
+    static void PushCached(lua_State* l, void* ptr, const char* meta) {
+        lua_rawgetp(l, LUA_REGISTRYINDEX, &kCacheKey);
+        if (lua_rawgetp(l, -1, ptr) == LUA_TUSERDATA) {
+            lua_remove(l, -2);
+            return;
+        }
+
+        lua_pop(l, 1);
+        *static_cast<void**>(lua_newuserdata(l, sizeof(void*))) = ptr;
+        luaL_setmetatable(l, meta);
+        lua_pushvalue(l, -1);
+        lua_rawsetp(l, -3, ptr);
+        lua_remove(l, -2);
+    }
+
+    void PushObj(lua_State* l, BenchObj* obj) {
+        PushCached(l, obj, kObjMeta);
+    }
+
+    BenchObj* ToObj(lua_State* l, int index) {
+        auto* p = static_cast<BenchObj**>(luaL_testudata(l, index, kObjMeta));
+        return p ? *p : nullptr;
+    }
+
+    void PushVector(lua_State* l, std::vector<int>* vec) {
+        PushCached(l, vec, kVectorMeta);
+    }
+
+    void PushFunction(lua_State* l, std::function<int(int)>* func) {
+        lua_pushlightuserdata(l, func);
+        lua_pushcclosure(l, &CallFunction, 1);
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "bench_export.h"
+#include <functional>
+#include <vector>
+
+struct lua_State;
+
+/* hand-written lua c api binding of the bench types, the baseline of xlua */
+namespace raw {
+    void Register(lua_State* l);
+
+    /* push the cached userdata of the object, created at first push */
+    void PushObj(lua_State* l, BenchObj* obj);
+    BenchObj* ToObj(lua_State* l, int index);
+    void PushVector(lua_State* l, std::vector<int>* vec);
+    void PushFunction(lua_State* l, std::function<int(int)>* func);
+}
@@ -0,0 +1,208 @@
+#include "bench_export.h"
+#include <xlua_state.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+/* gc churn and object lifetime stress
+ * every frame spawns short lived objects, lua holds them in a ring for some frames,
+ * the c++ side keeps them alive exactly as long, the gc is only driven by the frame budgeted GcStep
+*/
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Config {
+        uint64_t objs = 1000000;    // objects of each kind
+        int frame = 1000;           // objects spawned per frame
+        int life = 8;               // frames the object lives
+        uint64_t budget_us = 500;   // GcStep budget per frame
+        const char* filter = nullptr;
+        bool csv = false;
+    };
+
+    struct Report {
+        double objs_s = 0;
+        xlua::AllocStats alloc;
+        xlua::CacheStats max;
+        xlua::CacheStats last;      // after a full gc
+        std::vector<uint64_t> pauses;   // GcStep ns of each frame
+        size_t cycles = 0;
+    };
+
+    const char* kScript = R"(
+        ring = {}
+        function churn_hold(slot, o)
+            ring[slot] = o
+            o.a = slot
+        end
+    )";
+
+    inline size_t& Max(size_t& l, size_t r) {
+        if (r > l)
+            l = r;
+        return l;
+    }
+
+    void Track(xlua::CacheStats& max, const xlua::CacheStats& cur) {
+        Max(max.value_uds, cur.value_uds);
+        Max(max.value_refs, cur.value_refs);
+        Max(max.declared_ptr_uds, cur.declared_ptr_uds);
+        Max(max.collection_ptr_uds, cur.collection_ptr_uds);
+        Max(max.smart_ptr_uds, cur.smart_ptr_uds);
+        Max(max.weak_obj_uds, cur.weak_obj_uds);
+        Max(max.weak_obj_slots, cur.weak_obj_slots);
+        Max(max.gc_pending, cur.gc_pending);
+    }
+
+    /* spawn(s, slot) pushes a new object to the lua ring slot and releases the one it replaced */
+    template <typename Fn>
+    Report Churn(const Config& cfg, Fn&& spawn) {
+        Report report;
+        xlua::State* s = xlua::Create(nullptr, true);    // the memory peak comes from the pool statistics
+        s->DoString(kScript, "gc_churn");
+        s->SetGcAuto(false);
+
+        const int ring = cfg.frame * cfg.life;
+        uint64_t frames = (cfg.objs + cfg.frame - 1) / cfg.frame;
+        report.pauses.reserve((size_t)frames);
+
+        auto begin = Clock::now();
+        uint64_t spawned = 0;
+        for (uint64_t f = 0; f < frames; ++f) {
+            for (int i = 0; i < cfg.frame; ++i, ++spawned)
+                spawn(s, (int)(spawned % ring) + 1);
+
+            auto step = Clock::now();
+            s->GcStep(cfg.budget_us);
+            report.pauses.push_back((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - step).count());
+            Track(report.max, s->GetCacheStats());
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+
+        report.objs_s = ns ? (double)spawned * 1e9 / ns : 0;
+        report.alloc = s->GetAllocStats();
+        report.cycles = s->GetGcStats().cycles;
+
+        s->DoString("ring = {}", "gc_churn");
+        s->Gc();
+        report.last = s->GetCacheStats();
+        s->Release();
+        return report;
+    }
+
+    double Percentile(const std::vector<uint64_t>& sorted, double p) {
+        if (sorted.empty())
+            return 0;
+        size_t idx = (size_t)(p * (sorted.size() - 1));
+        return sorted[idx] / 1000.0;
+    }
+
+    /* the cache the kind of object goes */
+    size_t Cache(const xlua::CacheStats& stats, const char* kind) {
+        if (strcmp(kind, "ptr") == 0)
+            return stats.declared_ptr_uds;
+        if (strcmp(kind, "weak") == 0)
+            return stats.weak_obj_uds;
+        if (strcmp(kind, "shared") == 0)
+            return stats.smart_ptr_uds;
+        return stats.value_uds;
+    }
+
+    void Print(const Config& cfg, const char* kind, Report& report) {
+        std::sort(report.pauses.begin(), report.pauses.end());
+        double p50 = Percentile(report.pauses, 0.5);
+        double p95 = Percentile(report.pauses, 0.95);
+        double p99 = Percentile(report.pauses, 0.99);
+        double max = Percentile(report.pauses, 1.0);
+
+        if (cfg.csv) {
+            printf("%s,%d,%.0f,%zu,%zu,%zu,%zu,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%zu\n", kind, XLUA_ENABLE_LUD_OPTIMIZE,
+                report.objs_s, report.alloc.peak / 1024, report.alloc.xlua / 1024,
+                Cache(report.max, kind), report.max.weak_obj_slots, Cache(report.last, kind), report.last.gc_pending,
+                p50, p95, p99, max, report.cycles);
+        } else {
+            printf("%-8s %12.0f %10zu %8zu %10zu %10zu %8zu %8.1f %8.1f %8.1f %8.1f %7zu\n", kind,
+                report.objs_s, report.alloc.peak / 1024, report.alloc.xlua / 1024,
+                Cache(report.max, kind), report.max.weak_obj_slots, Cache(report.last, kind),
+                p50, p95, p99, max, report.cycles);
+        }
+        fflush(stdout);
+    }
+
+    template <typename Fn>
+    void Run(const Config& cfg, const char* kind, Fn&& spawn) {
+        if (cfg.filter && strstr(kind, cfg.filter) == nullptr)
+            return;
+        Report report = Churn(cfg, spawn);
+        Print(cfg, kind, report);
+    }
+}
+
+/* usage: bench_gc [filter] [-csv] [-n=objects] [-frame=N] [-life=frames] [-budget=us] */
+int main(int argc, char* argv[]) {
+    Config cfg;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-csv") == 0)
+            cfg.csv = true;
+        else if (strncmp(argv[i], "-n=", 3) == 0)
+            cfg.objs = strtoull(argv[i] + 3, nullptr, 10);
+        else if (strncmp(argv[i], "-frame=", 7) == 0)
+            cfg.frame = std::max(1, atoi(argv[i] + 7));
+        else if (strncmp(argv[i], "-life=", 6) == 0)
+            cfg.life = std::max(1, atoi(argv[i] + 6));
+        else if (strncmp(argv[i], "-budget=", 8) == 0)
+            cfg.budget_us = strtoull(argv[i] + 8, nullptr, 10);
+        else
+            cfg.filter = argv[i];
+    }
+
+    if (cfg.csv) {
+        printf("kind,lud,objs_s,peak_kb,xlua_kb,max_cache,max_weak_slots,final_cache,final_pending,"
+            "gc_p50_us,gc_p95_us,gc_p99_us,gc_max_us,gc_cycles\n");
+    } else {
+        printf("lud optimize:%d objects:%llu frame:%d life:%d budget:%lluus\n", XLUA_ENABLE_LUD_OPTIMIZE,
+            (unsigned long long)cfg.objs, cfg.frame, cfg.life, (unsigned long long)cfg.budget_us);
+        printf("%-8s %12s %10s %8s %10s %10s %8s %8s %8s %8s %8s %7s\n", "kind", "objs/s", "peak KB", "xlua KB",
+            "max cache", "weak slots", "final", "p50 us", "p95 us", "p99 us", "max us", "cycles");
+    }
+
+    const size_t ring = (size_t)cfg.frame * cfg.life;
+
+    /* raw pointer of declared type, the freed address is soon reused by new object */
+    std::vector<std::unique_ptr<BenchObj>> objs(ring);
+    Run(cfg, "ptr", [&objs](xlua::State* s, int slot) {
+        std::unique_ptr<BenchObj> obj(new BenchObj);
+        s->Call("churn_hold", std::tie(), slot, obj.get());
+        objs[slot - 1] = std::move(obj);
+    });
+    objs.clear();
+
+    /* xlua weak object, the index is released with the object */
+    std::vector<std::unique_ptr<BenchWeakObj>> weak_objs(ring);
+    Run(cfg, "weak", [&weak_objs](xlua::State* s, int slot) {
+        std::unique_ptr<BenchWeakObj> obj(new BenchWeakObj);
+        s->Call("churn_hold", std::tie(), slot, obj.get());
+        weak_objs[slot - 1] = std::move(obj);
+    });
+    weak_objs.clear();
+
+    /* shared_ptr, lua holds a copy of the smart pointer */
+    std::vector<std::shared_ptr<BenchObj>> shared_objs(ring);
+    Run(cfg, "shared", [&shared_objs](xlua::State* s, int slot) {
+        auto obj = std::make_shared<BenchObj>();
+        s->Call("churn_hold", std::tie(), slot, obj);
+        shared_objs[slot - 1] = std::move(obj);
+    });
+    shared_objs.clear();
+
+    /* lua owned value object */
+    Run(cfg, "value", [](xlua::State* s, int slot) {
+        s->Call("churn_hold", std::tie(), slot, BenchObj());
+    });
+    return 0;
+}
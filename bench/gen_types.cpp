@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+/* generate synthetic export types for the startup benchmark
+ * usage: gen_types <out_dir> <classes> <members> <classes_per_file>
+ * output: gen_types.h, gen_types_<n>.cpp
+ * half of the members are variates and half are functions
+*/
+
+static bool WriteHeader(const std::string& dir, int classes, int members) {
+    std::string path = dir + "/gen_types.h";
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == nullptr)
+        return false;
+
+    int vars = members / 2;
+    int funcs = members - vars;
+    fprintf(f, "/* generated by gen_types, do not edit */\n");
+    fprintf(f, "#pragma once\n#include <xlua_def.h>\n\n");
+    fprintf(f, "#define GEN_TYPE_NUM %d\n#define GEN_MEMBER_NUM %d\n\n", classes, members);
+    for (int i = 0; i < classes; ++i) {
+        fprintf(f, "struct GenType%d {\n", i);
+        for (int v = 0; v < vars; ++v)
+            fprintf(f, "    int v%d = %d;\n", v, v);
+        for (int n = 0; n < funcs; ++n)
+            fprintf(f, "    int F%d(int x) const { return v%d + x; }\n", n, vars ? n % vars : 0);
+        fprintf(f, "};\n");
+        fprintf(f, "XLUA_DECLARE_CLASS(GenType%d);\n\n", i);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool WriteSource(const std::string& dir, int file, int begin, int end, int members) {
+    std::string path = dir + "/gen_types_" + std::to_string(file) + ".cpp";
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == nullptr)
+        return false;
+
+    int vars = members / 2;
+    int funcs = members - vars;
+    fprintf(f, "/* generated by gen_types, do not edit */\n");
+    fprintf(f, "#include \"gen_types.h\"\n#include <xlua_export.h>\n\n");
+    for (int i = begin; i < end; ++i) {
+        fprintf(f, "XLUA_EXPORT_CLASS_BEGIN(GenType%d)\n", i);
+        for (int v = 0; v < vars; ++v)
+            fprintf(f, "XLUA_VARIATE(GenType%d::v%d)\n", i, v);
+        for (int n = 0; n < funcs; ++n)
+            fprintf(f, "XLUA_FUNCTION(GenType%d::F%d)\n", i, n);
+        fprintf(f, "XLUA_EXPORT_CLASS_END()\n\n");
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        printf("usage: gen_types <out_dir> <classes> <members> <classes_per_file>\n");
+        return 1;
+    }
+
+    std::string dir = argv[1];
+    int classes = atoi(argv[2]);
+    int members = atoi(argv[3]);
+    int per_file = atoi(argv[4]);
+    if (classes < 0 || members < 0 || per_file <= 0) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    if (!WriteHeader(dir, classes, members)) {
+        printf("write %s/gen_types.h failed\n", dir.c_str());
+        return 1;
+    }
+
+    /* always write the files cmake expects, even if empty */
+    int files = (classes + per_file - 1) / per_file;
+    for (int i = 0; i < (files ? files : 1); ++i) {
+        int begin = i * per_file;
+        int end = begin + per_file < classes ? begin + per_file : classes;
+        if (!WriteSource(dir, i, begin, end, members)) {
+            printf("write %s/gen_types_%d.cpp failed\n", dir.c_str(), i);
+            return 1;
+        }
+    }
+    return 0;
+}
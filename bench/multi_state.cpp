@@ -0,0 +1,128 @@
+#include "bench_export.h"
+#include <xlua_state.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/* multi state scaling
+ * every thread owns a state and runs the same mixed binding workload,
+ * the shared global environment (state list, weak object slots) shows up as the lost scaling
+*/
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    static const int kLoop = 100;       // operations of each call
+
+    const char* kScript = R"(
+        function bench_mixed(o, w, sp, n)
+            local s = 0
+            for i = 1, n do
+                o.a = i
+                s = s + o:Sum3(i, 2, 3)
+                w.a = w.a + 1
+                s = s + sp:Get()
+            end
+            return s
+        end
+    )";
+
+    struct Worker {
+        BenchObj obj;
+        BenchWeakObj weak;
+        std::shared_ptr<BenchObj> shared = std::make_shared<BenchObj>();
+        uint64_t ops = 0;
+        bool ok = true;
+    };
+
+    void Work(Worker* w, const std::atomic<int>* phase) {
+        xlua::State* s = xlua::Create(nullptr);
+        w->ok = s->DoString(kScript, "multi_state");
+
+        while (phase->load(std::memory_order_acquire) == 0)
+            std::this_thread::yield();
+
+        while (w->ok && phase->load(std::memory_order_relaxed) == 1) {
+            int sum = 0;
+            /* push the objects every call, the identity caches are queried as well */
+            w->ok = (bool)s->Call("bench_mixed", std::tie(sum), &w->obj, &w->weak, w->shared, kLoop);
+            w->ops += kLoop;
+        }
+        s->Release();
+    }
+
+    /* return total operations per second */
+    double Run(int threads, uint64_t ms, bool* ok) {
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> pool;
+        std::atomic<int> phase{0};  // 0: prepare, 1: run, 2: stop
+
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back(new Worker());
+            pool.emplace_back(&Work, workers.back().get(), &phase);
+        }
+
+        auto begin = Clock::now();
+        phase.store(1, std::memory_order_release);
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        phase.store(2, std::memory_order_release);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+
+        uint64_t ops = 0;
+        for (int i = 0; i < threads; ++i) {
+            pool[i].join();
+            ops += workers[i]->ops;
+            *ok = *ok && workers[i]->ok;
+        }
+        return ns ? (double)ops * 1e9 / ns : 0;
+    }
+}
+
+/* usage: bench_mt [-csv] [-ms=N] [-max=threads] */
+int main(int argc, char* argv[]) {
+    bool csv = false;
+    uint64_t ms = 500;
+    int max = 64;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-csv") == 0)
+            csv = true;
+        else if (strncmp(argv[i], "-ms=", 4) == 0)
+            ms = strtoull(argv[i] + 4, nullptr, 10);
+        else if (strncmp(argv[i], "-max=", 5) == 0)
+            max = atoi(argv[i] + 5);
+    }
+
+    /* the export types are finalized by the first state, not in the worker threads */
+    xlua::Create(nullptr)->Release();
+
+    if (csv) {
+        printf("threads,ops_s,ops_s_thread,speedup,efficiency\n");
+    } else {
+        printf("hardware threads:%u ms:%llu\n", std::thread::hardware_concurrency(), (unsigned long long)ms);
+        printf("%-8s %14s %14s %8s %10s\n", "threads", "ops/s", "ops/s/thread", "speedup", "efficiency");
+    }
+
+    double base = 0;
+    bool ok = true;
+    for (int threads = 1; threads <= max; threads *= 2) {
+        double ops_s = Run(threads, ms, &ok);
+        if (threads == 1)
+            base = ops_s;
+
+        double speedup = base > 0 ? ops_s / base : 0;
+        if (csv)
+            printf("%d,%.0f,%.0f,%.2f,%.2f\n", threads, ops_s, ops_s / threads, speedup, speedup / threads);
+        else
+            printf("%-8d %14.0f %14.0f %8.2f %10.2f\n", threads, ops_s, ops_s / threads, speedup, speedup / threads);
+        fflush(stdout);
+    }
+
+    if (!ok)
+        printf("workload failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include "gen_types.h"
+#include <xlua_state.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+/* state startup with thousands of generated export types
+ * the first state finalizes the type descs, the later states only register them
+*/
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Sample {
+        double create_us = 0;
+        double release_us = 0;
+        xlua::StartupStats startup;
+        double live_kb = 0;         // lua heap after creation
+        double xlua_kb = 0;         // xlua containers
+        double arena_kb = 0;        // reserved by the pool allocator
+    };
+
+    inline double Us(Clock::time_point begin, Clock::time_point end) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / 1000.0;
+    }
+
+    Sample Once() {
+        Sample sample;
+        auto begin = Clock::now();
+        xlua::State* s = xlua::Create(nullptr, true);    // the memory columns come from the pool statistics
+        auto end = Clock::now();
+        sample.create_us = Us(begin, end);
+        sample.startup = s->GetStartupStats();
+
+        auto alloc = s->GetAllocStats();
+        sample.live_kb = alloc.live / 1024.0;
+        sample.xlua_kb = alloc.xlua / 1024.0;
+        sample.arena_kb = alloc.arena / 1024.0;
+
+        begin = Clock::now();
+        s->Release();
+        sample.release_us = Us(begin, Clock::now());
+        return sample;
+    }
+
+    void Print(const char* name, const Sample& s, bool csv) {
+        if (csv) {
+            printf("%s,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", name, (int)s.startup.declared,
+                s.create_us, (double)s.startup.init_us, (double)s.startup.reg_us, (double)s.startup.script_us,
+                (double)s.startup.declared_us, s.release_us, s.live_kb, s.xlua_kb, s.arena_kb);
+        } else {
+            printf("%-8s %8d %12.1f %10.1f %10.1f %10.1f %12.1f %12.1f %10.1f %10.1f %10.1f\n", name,
+                (int)s.startup.declared, s.create_us, (double)s.startup.init_us, (double)s.startup.reg_us,
+                (double)s.startup.script_us, (double)s.startup.declared_us, s.release_us, s.live_kb, s.xlua_kb, s.arena_kb);
+        }
+        fflush(stdout);
+    }
+}
+
+/* usage: bench_startup [-csv] [-n=states] */
+int main(int argc, char* argv[]) {
+    bool csv = false;
+    int n = 20;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-csv") == 0)
+            csv = true;
+        else if (strncmp(argv[i], "-n=", 3) == 0)
+            n = atoi(argv[i] + 3);
+    }
+
+    if (csv) {
+        printf("run,types,create_us,init_us,reg_us,script_us,declared_us,release_us,live_kb,xlua_kb,arena_kb\n");
+    } else {
+        printf("generated types:%d members:%d states:%d\n", GEN_TYPE_NUM, GEN_MEMBER_NUM, n);
+        printf("%-8s %8s %12s %10s %10s %10s %12s %12s %10s %10s %10s\n", "run", "types", "create us",
+            "init us", "reg us", "script us", "declared us", "release us", "live KB", "xlua KB", "arena KB");
+    }
+
+    /* the first state finalizes the type descs */
+    Print("first", Once(), csv);
+
+    Sample avg;
+    for (int i = 0; i < n; ++i) {
+        Sample s = Once();
+        avg.create_us += s.create_us / n;
+        avg.release_us += s.release_us / n;
+        avg.startup.init_us += s.startup.init_us;
+        avg.startup.reg_us += s.startup.reg_us;
+        avg.startup.script_us += s.startup.script_us;
+        avg.startup.declared_us += s.startup.declared_us;
+        avg.startup.declared = s.startup.declared;
+        avg.live_kb += s.live_kb / n;
+        avg.xlua_kb += s.xlua_kb / n;
+        avg.arena_kb += s.arena_kb / n;
+    }
+
+    if (n > 0) {
+        avg.startup.init_us /= n;
+        avg.startup.reg_us /= n;
+        avg.startup.script_us /= n;
+        avg.startup.declared_us /= n;
+        Print("average", avg, csv);
+    }
+    return 0;
+}
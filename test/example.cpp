@@ -1,6 +1,7 @@
 #include "example.h"
 
 int LifeTime::s_counter = 0;
+int DeferLifeTime::s_counter = 0;
 
 /* static member var */
 bool TestMember::s_boolean_val = false;
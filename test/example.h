@@ -195,6 +195,17 @@ struct LifeTime {
     static int s_counter;
 };
 
+/* large payload, destruction is deferred */
+struct DeferLifeTime {
+    DeferLifeTime() : buff(1024) { ++s_counter; }
+    DeferLifeTime(const DeferLifeTime& o) : buff(o.buff) { ++s_counter; }
+    DeferLifeTime(DeferLifeTime&& o) noexcept : buff(std::move(o.buff)) { ++s_counter; }
+    ~DeferLifeTime() { --s_counter; }
+
+    std::vector<int> buff;
+    static int s_counter;
+};
+
 /* member and static member */
 struct ExportObj {
 };
@@ -398,7 +409,7 @@ struct Object {
     XLUA_DECLARE_OBJ_INDEX;
 
     ~Object() {
-        strcpy_s(name, 64, "destructed");
+        snprintf(name, 64, "destructed");
     }
 
     virtual int Update(int delta) = 0;
@@ -587,6 +598,23 @@ struct Ray {
     Vec2 dir;
 };
 
+/* struct converted with lua table by value */
+struct ItemCfg {
+    int id = 0;
+    std::string name;
+    float weight = 0;
+};
+
+struct MonsterCfg {
+    int id = 0;
+    std::string name;
+    Vec2 pos;
+    ItemCfg drop;
+    std::vector<int> skills;
+    std::vector<ItemCfg> items;
+    std::map<std::string, int> attrs;
+};
+
 struct Collider : WeakObj {
     virtual ~Collider() {}
 
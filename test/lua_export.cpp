@@ -92,8 +92,8 @@ XLUA_FUNCTION_AS(TestTriangleValue, TestExportParams::TestValue)
 //XLUA_FUNCTION_AS(TestNoneExport4, TestNoneExport, xLuaWeakObjPtr<NoneExport>)  // compile error
 XLUA_EXPORT_CLASS_END()
 
-XLUA_EXPORT_CLASS_BEGIN(Global::TestStaticParams)
 using cls = Global::TestStaticParams;
+XLUA_EXPORT_CLASS_BEGIN(Global::TestStaticParams)
 XLUA_FUNCTION_AS(TestBool, cls::Test, bool)
 XLUA_FUNCTION_AS(TestChar, cls::Test, char)
 XLUA_FUNCTION_AS(TestUChar, cls::Test, unsigned char)
@@ -261,6 +261,9 @@ XLUA_EXPORT_CLASS_END()
 XLUA_EXPORT_CLASS_BEGIN(LifeTime)
 XLUA_EXPORT_CLASS_END()
 
+XLUA_EXPORT_CLASS_BEGIN(DeferLifeTime)
+XLUA_EXPORT_CLASS_END()
+
 XLUA_EXPORT_CLASS_BEGIN(Object)
 XLUA_VARIATE(Object::id_)
 XLUA_VARIATE(Object::name)
@@ -325,3 +328,19 @@ XLUA_VARIATE(M_C_2::c_2)
 XLUA_VARIATE(M_G_2::g_1)
 XLUA_VARIATE(M_G_2::g_2)
 XLUA_EXPORT_CLASS_END()
+
+XLUA_EXPORT_STRUCT_BEGIN(ItemCfg)
+XLUA_FIELD(ItemCfg::id)
+XLUA_FIELD(ItemCfg::name)
+XLUA_FIELD(ItemCfg::weight)
+XLUA_EXPORT_STRUCT_END()
+
+XLUA_EXPORT_STRUCT_BEGIN(MonsterCfg)
+XLUA_FIELD(MonsterCfg::id)
+XLUA_FIELD(MonsterCfg::name)
+XLUA_FIELD(MonsterCfg::pos)
+XLUA_FIELD(MonsterCfg::drop)
+XLUA_FIELD(MonsterCfg::skills)
+XLUA_FIELD(MonsterCfg::items)
+XLUA_FIELD_AS(attributes, MonsterCfg::attrs)
+XLUA_EXPORT_STRUCT_END()
@@ -18,6 +18,7 @@ XLUA_DECLARE_CLASS(Image);
 XLUA_DECLARE_CLASS(Label);
 XLUA_DECLARE_CLASS(Button);
 XLUA_DECLARE_CLASS(LifeTime);
+XLUA_DECLARE_CLASS(DeferLifeTime);
 XLUA_DECLARE_CLASS(Object);
 XLUA_DECLARE_CLASS(Character);
 XLUA_DECLARE_CLASS(Doodad);
@@ -41,8 +42,14 @@ XLUA_DECLARE_CLASS(M_E_2);
 XLUA_DECLARE_CLASS(M_F_2);
 XLUA_DECLARE_CLASS(M_G_2);
 
+XLUA_DECLARE_STRUCT(ItemCfg);
+XLUA_DECLARE_STRUCT(MonsterCfg);
+
 XLUA_NAMESPACE_BEGIN
 
+template <>
+struct DeferDestruct<DeferLifeTime> : std::true_type {};
+
 template<>
 struct Support<Color> : ValueCategory<Color, false> {
     static inline const char* Name() { return "Color"; }
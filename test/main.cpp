@@ -1,6 +1,11 @@
 ﻿#include "lua_export.h"
 #include "test.h"
+#ifdef _WIN32
+/* the bundled headers match the prebuilt gtest.lib */
 #include "gtest/gtest.h"
+#else
+#include <gtest/gtest.h>
+#endif // _WIN32
 #include <stdio.h>
 
 int main(int argc, char* argv[]) {
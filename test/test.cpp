@@ -1,5 +1,13 @@
 #include "lua_export.h"
+#ifdef _WIN32
+/* the bundled headers match the prebuilt gtest.lib */
 #include "gtest/gtest.h"
+#else
+#include <gtest/gtest.h>
+#endif // _WIN32
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 static constexpr const char* kCheckFunc = "function Check(...) return ... end";
 
@@ -290,7 +298,7 @@ TEST(xlua, LuaCallGuard) {
     /* need guard */
     Object* ptr = nullptr;
     Doodad obj;
-    strcpy_s(obj.name, 64, "hello world");
+    snprintf(obj.name, 64, "hello world");
 
     ASSERT_TRUE(s->Call("Check", std::tie(ptr), obj));
     ASSERT_NE(ptr, &obj);                       // the ptr is refer the lua object
@@ -425,6 +433,312 @@ TEST(xlua, TestTable) {
     s->Release();
 }
 
+TEST(xlua, TestTableForEach) {
+    xlua::State* s = xlua::Create(nullptr);
+    xlua::Table table;
+    XCALL_SUCC(s->DoString("return {1, 2, 3, name = 'xlua', sub = {4, 5}}", "", std::tie(table))) {
+        int sum = 0;
+        int tables = 0;
+        std::string name;
+        table.ForEach([&](const xlua::TableCursor& cursor) {
+            if (cursor.GetKeyType() == xlua::VarType::kNumber)
+                sum += cursor.GetValue<int>();
+            else if (cursor.GetValueType() == xlua::VarType::kString)
+                name = cursor.GetValue<const char*>();
+            else if (cursor.GetState()->ForEach(cursor.GetValueIndex(), [&](const xlua::TableCursor& sub) {
+                sum += sub.GetValue<int>();
+            }))
+                ++tables;
+        });
+        ASSERT_EQ(sum, 15);
+        ASSERT_EQ(tables, 1);
+        ASSERT_EQ(name, "xlua");
+        ASSERT_EQ(s->GetTop(), 1);
+
+        /* stop by return false */
+        int visited = 0;
+        table.ForEach([&visited](const xlua::TableCursor& cursor) {
+            return ++visited < 2;
+        });
+        ASSERT_EQ(visited, 2);
+
+        int count = 0;
+        s->ForEach<int, int>(-1, [&](int key, int value) {
+            if (key > 0 && key == value)    // not number is loaded as 0
+                ++count;
+        });
+        ASSERT_EQ(count, 3);
+
+        /* number keys loaded as string */
+        std::set<std::string> keys;
+        s->ForEach<std::string, int>(-1, [&](std::string key, int value) { keys.insert(key); });
+        ASSERT_EQ(keys, (std::set<std::string>{"1", "2", "3", "name", "sub"}));
+
+        std::set<std::string> num_keys;
+        table.ForEach([&](const xlua::TableCursor& cursor) {
+            if (cursor.GetKeyType() == xlua::VarType::kNumber)
+                num_keys.insert(cursor.GetKey<const char*>());
+        });
+        ASSERT_EQ(num_keys, (std::set<std::string>{"1", "2", "3"}));
+        ASSERT_EQ(s->GetTop(), 1);
+
+        s->Push(count);
+        ASSERT_FALSE(s->ForEach(-1, [](const xlua::TableCursor&) {}));
+        s->PopTop(1);
+        ASSERT_EQ(s->GetTop(), 1);
+    }
+
+    table = nullptr;
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestVariantString) {
+    xlua::State* s = xlua::Create(nullptr);
+    const char* text = "a string longer than the small buffer";
+
+    s->Push(text);
+    s->Push("short");
+    const char* lua_str = s->Get<const char*>(-2);
+    auto copy_var = s->Get<xlua::Variant>(-2);
+    auto long_var = s->GetVariant(-2, true);
+    auto short_var = s->GetVariant(-1, true);
+    s->PopTop(2);
+
+    /* copied by default */
+    ASSERT_NE(copy_var.ToCStr(), lua_str);
+    ASSERT_EQ(copy_var, long_var);
+
+    /* long string refers the lua string */
+    ASSERT_EQ(long_var.GetType(), xlua::VarType::kString);
+    ASSERT_EQ(long_var.ToCStr(), lua_str);
+    ASSERT_EQ(long_var.StrLen(), strlen(text));
+    ASSERT_EQ(long_var.ToString(), text);
+    ASSERT_STREQ(short_var.ToCStr(), "short");
+    ASSERT_EQ(short_var.StrLen(), 5);
+
+    s->Gc();
+    auto copy = long_var;
+    long_var = xlua::Variant();
+    ASSERT_STREQ(copy.ToCStr(), text);
+    ASSERT_EQ(copy, xlua::Variant(text, strlen(text)));
+    ASSERT_NE(copy, short_var);
+
+    s->Push(copy);
+    ASSERT_EQ(s->Get<std::string>(-1), text);
+    s->PopTop(1);
+    ASSERT_EQ(xlua::Variant(1.0).ToString(), "");
+
+    /* refered string pushed to other state is copied */
+    xlua::State* other = xlua::Create(nullptr);
+    other->Push(copy);
+    ASSERT_EQ(s->GetTop(), 0);
+    ASSERT_EQ(other->GetTop(), 1);
+    ASSERT_EQ(other->Get<std::string>(-1), text);
+    other->PopTop(1);
+    other->Release();
+
+    copy = xlua::Variant();
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+
+    /* the copied string outlives the state */
+    ASSERT_EQ(copy_var.ToString(), text);
+}
+
+TEST(xlua, TestStruct) {
+    xlua::State* s = xlua::Create(nullptr);
+    const char* script = R"(
+        return {
+            id = 7, name = "slime", pos = {x = 1, y = 2}, unknown = 3,
+            drop = {id = 100, name = "gel", weight = 0.5},
+            skills = {1, 2, 3},
+            items = {{id = 1, name = "a"}, {id = 2, name = "b", weight = 2}},
+            attributes = {hp = 10, mp = 5},
+        }
+    )";
+
+    MonsterCfg cfg;
+    ASSERT_TRUE(s->DoString(script, "struct", std::tie(cfg)));
+    ASSERT_EQ(cfg.id, 7);
+    ASSERT_EQ(cfg.name, "slime");
+    ASSERT_EQ(cfg.pos.y, 2);
+    ASSERT_EQ(cfg.drop.name, "gel");
+    ASSERT_EQ(cfg.drop.weight, 0.5f);
+    ASSERT_EQ(cfg.skills, std::vector<int>({1, 2, 3}));
+    ASSERT_EQ(cfg.items.size(), 2);
+    ASSERT_EQ(cfg.items[1].name, "b");
+    ASSERT_EQ(cfg.items[1].weight, 2);
+    ASSERT_EQ(cfg.attrs.size(), 2);
+    ASSERT_EQ(cfg.attrs["mp"], 5);
+
+    /* push as table and load back */
+    cfg.items[0].id = 11;
+    s->Push(cfg);
+    ASSERT_EQ(s->GetType(-1), xlua::VarType::kTable);
+    ASSERT_EQ(s->GetField<int>(-1, "id"), 7);
+    ASSERT_EQ(s->GetField<std::string>(-1, "name"), "slime");
+    MonsterCfg copy = s->Get<MonsterCfg>(-1);
+    s->PopTop(1);
+    ASSERT_EQ(copy.items[0].id, 11);
+    ASSERT_EQ(copy.skills, cfg.skills);
+    ASSERT_EQ(copy.attrs, cfg.attrs);
+
+    /* the field is skipped if the value is not accepted */
+    ItemCfg item;
+    ASSERT_TRUE(s->DoString("return {id = 3, name = 4}", "struct", std::tie(item)));
+    ASSERT_EQ(item.id, 3);
+    ASSERT_EQ(item.name, "");
+
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestTableToContainer) {
+    xlua::State* s = xlua::Create(nullptr);
+    std::function<int(std::vector<int>)> sum_vector = [](std::vector<int> v) {
+        int sum = 0;
+        for (int x : v) sum += x;
+        return sum;
+    };
+    std::function<std::string(const std::list<std::string>&)> join_list = [](const std::list<std::string>& l) {
+        std::string str;
+        for (const auto& x : l) str += x;
+        return str;
+    };
+    std::function<int(std::map<std::string, int>)> map_value = [](std::map<std::string, int> m) {
+        return m["b"];
+    };
+    std::function<float(std::unordered_map<std::string, float>)> umap_size = [](std::unordered_map<std::string, float> m) {
+        return (float)m.size() + m["x"];
+    };
+    std::function<int(std::set<int>)> set_size = [](std::set<int> st) { return (int)st.size(); };
+    std::function<int(std::array<int, 3>)> array_last = [](std::array<int, 3> a) { return a[2]; };
+    s->SetGlobal("sum_vector", sum_vector);
+    s->SetGlobal("join_list", join_list);
+    s->SetGlobal("map_value", map_value);
+    s->SetGlobal("umap_size", umap_size);
+    s->SetGlobal("set_size", set_size);
+    s->SetGlobal("array_last", array_last);
+
+    int ret = 0;
+    std::string str;
+    float fret = 0;
+    ASSERT_TRUE(s->DoString("return sum_vector({1, 2, 3, 4.0, 'x'})", "conv", std::tie(ret)));
+    ASSERT_EQ(ret, 10);
+    ASSERT_TRUE(s->DoString("return join_list({'a', 'b', 'c'})", "conv", std::tie(str)));
+    ASSERT_EQ(str, "abc");
+    ASSERT_TRUE(s->DoString("return map_value({a = 1, b = 2})", "conv", std::tie(ret)));
+    ASSERT_EQ(ret, 2);
+    ASSERT_TRUE(s->DoString("return umap_size({x = 0.5, y = 1})", "conv", std::tie(fret)));
+    ASSERT_EQ(fret, 2.5f);
+    /* the pairs with not accepted key are skipped */
+    ASSERT_TRUE(s->DoString("return umap_size({x = 0.5, [2] = 5, [3] = 6, y = 1})", "conv", std::tie(fret)));
+    ASSERT_EQ(fret, 2.5f);
+    std::function<int(std::map<int, int>)> int_map_size = [](std::map<int, int> m) { return (int)m.size(); };
+    s->SetGlobal("int_map_size", int_map_size);
+    ASSERT_TRUE(s->DoString("return int_map_size({1, 2, a = 3})", "conv", std::tie(ret)));
+    ASSERT_EQ(ret, 2);
+    ASSERT_TRUE(s->DoString("return set_size({3, 1, 3, 2})", "conv", std::tie(ret)));
+    ASSERT_EQ(ret, 3);
+    ASSERT_TRUE(s->DoString("return array_last({1, 2, 3, 4})", "conv", std::tie(ret)));
+    ASSERT_EQ(ret, 3);
+
+    /* large table */
+    ASSERT_TRUE(s->DoString(R"(
+        local t = {}
+        for i = 1, 100000 do t[i] = i % 10 end
+        return sum_vector(t)
+    )", "conv", std::tie(ret)));
+    ASSERT_EQ(ret, 450000);
+
+    /* collection userdata is still accepted, other value is not */
+    std::vector<int> vec{1, 2};
+    ASSERT_TRUE(s->Call("sum_vector", std::tie(ret), &vec));
+    ASSERT_EQ(ret, 3);
+    ASSERT_FALSE(s->Call("sum_vector", std::tie(ret), 1));
+
+    /* non-const reference only refers the collection userdata, the change to a temporary is lost */
+    std::function<void(std::vector<int>&)> push_one = [](std::vector<int>& v) { v.push_back(1); };
+    s->SetGlobal("push_one", push_one);
+    ASSERT_FALSE(s->DoString("push_one({1})", "conv"));
+    ASSERT_TRUE(s->Call("push_one", std::tie(), &vec));
+    ASSERT_EQ(vec.size(), 3);
+
+    /* set and array as lua sequence */
+    s->Push(std::set<int>{5, 6});
+    ASSERT_EQ(s->GetType(-1), xlua::VarType::kTable);
+    ASSERT_EQ(s->GetField<int>(-1, 2), 6);
+    auto ary = s->Get<std::array<int, 2>>(-1);
+    ASSERT_EQ(ary[0], 5);
+    s->PopTop(1);
+
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+/* bulk copy between collection and lua table */
+TEST(xlua, TestCollectionTable) {
+    xlua::State* s = xlua::Create(nullptr);
+    ASSERT_TRUE(s->DoString(R"(
+        function vec_to_table(v)
+            local t = xlua.ToTable(v)
+            local sum = 0
+            for i = 1, #t do sum = sum + t[i] end
+            return #t, sum
+        end
+        function map_to_table(m)
+            return xlua.ToTable(m)["b"]
+        end
+        function vec_from_table(v, n)
+            local t = {}
+            for i = 1, n do t[i] = i * 2 end
+            xlua.FromTable(v, t)
+        end
+        function list_from_table(l)
+            xlua.FromTable(l, {'x', 'y'})
+        end
+        function to_table(v) return xlua.ToTable(v) end
+        function from_table(v, t) xlua.FromTable(v, t) end
+    )", "coll_table"));
+
+    std::vector<int> vec{1, 2, 3, 4};
+    int len = 0, sum = 0;
+    ASSERT_TRUE(s->Call("vec_to_table", std::tie(len, sum), &vec));
+    ASSERT_EQ(len, 4);
+    ASSERT_EQ(sum, 10);
+
+    /* the old elements are replaced */
+    ASSERT_TRUE(s->Call("vec_from_table", std::tie(), &vec, 3));
+    ASSERT_EQ(vec, (std::vector<int>{2, 4, 6}));
+
+    std::map<std::string, int> map{{"a", 1}, {"b", 2}};
+    int val = 0;
+    ASSERT_TRUE(s->Call("map_to_table", std::tie(val), &map));
+    ASSERT_EQ(val, 2);
+
+    std::list<std::string> lst;
+    ASSERT_TRUE(s->Call("list_from_table", std::tie(), &lst));
+    ASSERT_EQ(lst.size(), 2);
+    ASSERT_EQ(lst.back(), "y");
+
+    /* only collection object */
+    ASSERT_FALSE(s->Call("to_table", std::tie(), 1));
+    ASSERT_FALSE(s->Call("from_table", std::tie(), &vec, 1));
+
+    /* presized sequence from c++ */
+    double data[] = {0.5, 1.5, 2.5};
+    s->PushArray(data, 3);
+    ASSERT_EQ(s->GetType(-1), xlua::VarType::kTable);
+    ASSERT_EQ(s->GetField<double>(-1, 3), 2.5);
+    s->PushArray(vec);
+    ASSERT_EQ(s->GetField<int>(-1, 3), 6);
+    s->PopTop(2);
+
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
 /* vector list map unordered_map */
 TEST(xlua, TestCollection) {
     xlua::State* s = xlua::Create(nullptr);
@@ -1276,6 +1590,759 @@ TEST(xlua, TestExportTemplate) {
     s->Release();
 }
 
+TEST(xlua, TestAsyncCall) {
+    xlua::State* s = xlua::Create(nullptr);
+    std::vector<xlua::Async<int>> pending;
+
+    s->PushLambda([&pending](int v) -> xlua::Async<int> {
+        xlua::Async<int> ret;
+        if (v < 0)
+            ret.Resolve(-v);    // completed synchronously
+        else
+            pending.push_back(ret);
+        return ret;
+    });
+    ASSERT_TRUE(s->SetGlobal("Query"));
+
+    s->DoString(R"(
+        results = {}
+        function Run(id, v)
+            coroutine.wrap(function ()
+                local ok, r = pcall(Query, v)
+                results[id] = ok and r or "error:" .. r
+            end)()
+        end
+    )", "async");
+
+    EXPECT_TRUE(s->Call("Run", std::tie(), 1, 5));
+    ASSERT_EQ(pending.size(), 1);
+    ASSERT_TRUE(pending[0].IsWaiting());
+    xlua::Table results = s->GetGlobal<xlua::Table>("results");
+    ASSERT_EQ(results.GetField<int>(1), 0);
+    pending[0].Resolve(50);
+    ASSERT_FALSE(pending[0].IsWaiting());
+    ASSERT_EQ(results.GetField<int>(1), 50);
+
+    EXPECT_TRUE(s->Call("Run", std::tie(), 2, 6));
+    pending.back().Reject("timeout");
+    ASSERT_EQ(results.GetField<std::string>(2), "error:timeout");
+
+    EXPECT_TRUE(s->Call("Run", std::tie(), 3, -7));
+    ASSERT_EQ(results.GetField<int>(3), 7);
+
+    // can not wait outside coroutine
+    EXPECT_FALSE(s->Call("Query", std::tie(), 8));
+    ASSERT_FALSE(pending.back().IsWaiting());
+
+    // resumed by lua before the result is ready, the wait is released
+    bool ok = true;
+    std::string error;
+    s->DoString("co = coroutine.create(function () return Query(9) end) coroutine.resume(co)", "by_hand");
+    ASSERT_TRUE(pending.back().IsWaiting());
+    EXPECT_TRUE(s->DoString("return coroutine.resume(co, true, 1)", "by_hand", std::tie(ok, error)));
+    ASSERT_FALSE(ok);
+    ASSERT_NE(error.find("resumed unexpectedly"), std::string::npos);
+    ASSERT_FALSE(pending.back().IsWaiting());
+    pending.back().Resolve(9);
+
+    // the error of the coroutine resumed by async result is written to the log function
+    static std::string last_log;
+    s->SetLogFunc([](const char* msg) { last_log = msg; });
+    s->DoString("coroutine.wrap(function () Query(10) error('failed after wait') end)()", "log");
+    pending.back().Resolve(10);
+    ASSERT_NE(last_log.find("failed after wait"), std::string::npos);
+    s->SetLogFunc(nullptr);
+    pending.clear();
+
+    // thousands of in-flight waits
+    const int count = 10000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i <= count; ++i)
+        s->Call("Run", std::tie(), i, i);
+    auto wait = std::chrono::steady_clock::now();
+    for (auto& async : pending)
+        async.Resolve(1);
+    auto end = std::chrono::steady_clock::now();
+    printf("async wait: %d coroutines, wait %lld ns/op, resume %lld ns/op\n", count,
+        (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(wait - start).count() / count,
+        (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - wait).count() / count);
+
+    int total = 0;
+    for (int i = 1; i <= count; ++i)
+        total += results.GetField<int>(i);
+    ASSERT_EQ(total, count);
+
+    results = nullptr;
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestScheduler) {
+    xlua::State* s = xlua::Create(nullptr);
+    s->DoString(R"(
+        log = {}
+        function Start(name, op, v)
+            coroutine.wrap(function ()
+                xlua[op](v)
+                log[#log + 1] = name
+            end)()
+        end
+        function Last() return #log, log[#log] end
+    )", "scheduler");
+
+    int count = 0;
+    std::string last;
+    auto check_last = [&](int c, const char* name) {
+        EXPECT_TRUE(s->Call("Last", std::tie(count, last)));
+        ASSERT_EQ(count, c);
+        if (name)
+            ASSERT_EQ(last, name);
+    };
+
+    s->Tick(1000);  // start time
+    EXPECT_TRUE(s->Call("Start", std::tie(), "t100", "Wait", 100));
+    EXPECT_TRUE(s->Call("Start", std::tie(), "t300", "Wait", 300));
+    EXPECT_TRUE(s->Call("Start", std::tie(), "f2", "WaitFrames", 2));
+    EXPECT_TRUE(s->Call("Start", std::tie(), "s1", "WaitSignal", 1));
+    EXPECT_TRUE(s->Call("Start", std::tie(), "t70000", "Wait", 70000));
+    check_last(0, nullptr);
+
+    s->Tick(1050);
+    check_last(0, nullptr);
+    s->Tick(1100);
+    check_last(2, nullptr);
+    s->Signal(1);
+    check_last(2, nullptr);
+    s->Tick(1101);
+    check_last(3, "s1");
+    s->Tick(1299);
+    check_last(3, "s1");
+    s->Tick(1300);
+    check_last(4, "t300");
+    s->Tick(70999);
+    check_last(4, "t300");
+    s->Tick(71000);
+    check_last(5, "t70000");
+
+    // can not wait outside coroutine
+    EXPECT_FALSE(s->DoString("xlua.Wait(1)", "outside"));
+
+    // thousands of sleeping coroutines
+    const int count_co = 10000;
+    for (int i = 0; i < count_co; ++i)
+        s->Call("Start", std::tie(), "sleep", "Wait", 16 + i % 2000);
+    const int frames = 200;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i <= frames; ++i)
+        s->Tick(71000 + i * 16);
+    auto end = std::chrono::steady_clock::now();
+    check_last(5 + count_co, "sleep");
+    printf("scheduler: %d sleeping coroutines, tick %lld ns/frame\n", count_co,
+        (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / frames);
+
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestPoolAlloc) {
+    static constexpr const char* script_churn = R"(
+        return function (n)
+            local t = {}
+            for i = 1, n do
+                t[i % 100 + 1] = {i, tostring(i), x = i}
+            end
+        end
+    )";
+
+    auto churn = [](xlua::State* s, int n) {
+        xlua::Function func;
+        s->DoString(script_churn, "churn", std::tie(func));
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            s->Push(TestMember());  // value userdata
+            s->PopTop(1);
+        }
+        func(std::tie(), n);
+        s->Gc();
+        auto end = std::chrono::steady_clock::now();
+        return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / n;
+    };
+
+    xlua::State* s = xlua::Create(nullptr, true);
+    auto stats = s->GetAllocStats();
+    ASSERT_GT(stats.live, 0);
+    ASSERT_GE(stats.peak, stats.live);
+
+    size_t blocks = 0;
+    for (size_t c : stats.class_count)
+        blocks += c;
+    ASSERT_GT(blocks, 0);
+
+    /* blocks are aligned as malloc */
+    for (int i = 0; i < 4; ++i) {
+        s->NewTable();
+        ASSERT_EQ((uintptr_t)lua_topointer(s->GetLuaState(), -1) % alignof(std::max_align_t), 0);
+    }
+    s->PopTop(4);
+
+    const int n = 100000;
+    long long pool_ns = churn(s, n);
+    auto churn_stats = s->GetAllocStats();
+    ASSERT_GT(churn_stats.peak, stats.peak);
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+
+    xlua::State* m = xlua::Create(nullptr, false);
+    ASSERT_EQ(m->GetAllocStats().live, 0);
+    long long malloc_ns = churn(m, n);
+    ASSERT_EQ(m->GetTop(), 0);
+    m->Release();
+
+    printf("push/gc churn: pool %lld ns/op, malloc %lld ns/op, peak %u bytes\n",
+        pool_ns, malloc_ns, (unsigned)churn_stats.peak);
+}
+
+TEST(xlua, TestMemoryLimit) {
+    xlua::State* s = xlua::Create(nullptr, true);
+    auto stats = s->GetAllocStats();
+    ASSERT_GT(stats.xlua, 0);
+    ASSERT_TRUE(s->SetMemoryLimit(stats.live + stats.xlua + 512 * 1024));
+
+    {
+        xlua::CallGuard guard = s->DoString(
+            "local t = {} for i = 1, 10000000 do t[i] = tostring(i) end", "oom", std::tie());
+        ASSERT_FALSE(guard);
+        ASSERT_TRUE(guard.IsOutOfMemory());
+    }
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Gc();
+    ASSERT_TRUE(s->DoString("x = 1", "after_oom"));
+
+    // the allocations out of protected call are never refused, over quota is not a panic
+    auto cur = s->GetAllocStats();
+    ASSERT_TRUE(s->SetMemoryLimit(cur.live + cur.xlua));
+    for (int i = 0; i < 100; ++i) {
+        s->Push(TestMember());
+        s->NewTable();
+        s->PopTop(2);
+    }
+    {
+        xlua::CallGuard guard = s->DoString("local t = {} for i = 1, 1000 do t[i] = {} end", "oom", std::tie());
+        ASSERT_TRUE(guard.IsOutOfMemory());
+    }
+    ASSERT_EQ(s->GetTop(), 0);
+
+    // xlua containers are charged to the same budget
+    ASSERT_TRUE(s->SetMemoryLimit(0));
+    size_t xlua_mem = s->GetAllocStats().xlua;
+    for (int i = 0; i < 10000; ++i) {
+        s->Push(TestMember());
+        s->PopTop(1);
+    }
+    ASSERT_GT(s->GetAllocStats().xlua, xlua_mem);
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+
+    xlua::State* m = xlua::Create(nullptr, false);
+    ASSERT_FALSE(m->SetMemoryLimit(1024 * 1024));
+    m->Release();
+}
+
+TEST(xlua, TestMemoryLimitInCall) {
+    // the exported calls push new userdata until the quota is hit, the caches must stay consistent
+    std::vector<std::shared_ptr<TestMember>> pool(20000);
+    for (size_t i = 0; i < pool.size(); ++i) {
+        pool[i] = std::make_shared<TestMember>();
+        pool[i]->int_val = (int)i + 1;
+    }
+    std::function<std::shared_ptr<TestMember>(int)> get_obj = [&pool](int i) { return pool[i - 1]; };
+    std::function<TestMember(int)> new_value = [](int i) {
+        TestMember m;
+        m.int_val = i;
+        return m;
+    };
+
+    xlua::State* s = xlua::Create(nullptr, true);
+    s->SetGlobal("get_obj", get_obj);
+    s->SetGlobal("new_value", new_value);
+    // fill the tables first, the pushes allocate most in the loop
+    ASSERT_TRUE(s->DoString("objs, values = {}, {} for i = 1, 20000 do objs[i], values[i] = false, false end", "init"));
+    auto stats = s->GetAllocStats();
+    ASSERT_TRUE(s->SetMemoryLimit(stats.live + stats.xlua + 256 * 1024));
+    {
+        xlua::CallGuard guard = s->DoString(R"(
+            for i = 1, 20000 do
+                objs[i] = get_obj(i)
+                values[i] = new_value(i)
+                local name = "obj" .. i   -- the quota lifted in the pushes is hit by lua
+            end
+        )", "oom", std::tie());
+        ASSERT_TRUE(guard.IsOutOfMemory());
+    }
+    ASSERT_EQ(s->GetTop(), 0);
+
+    ASSERT_TRUE(s->SetMemoryLimit(0));
+    int count = 0;
+    ASSERT_TRUE(s->DoString(R"(
+        local n = 0
+        for i = 1, 20000 do
+            local obj, v = objs[i], values[i]
+            if not obj then break end
+            assert(obj == get_obj(i) and obj.int_val == i)
+            assert(not v or v.int_val == i)
+            n = n + 1
+        end
+        return n
+    )", "check", std::tie(count)));
+    ASSERT_GT(count, 0);
+    ASSERT_LT(count, 20000);
+
+    ASSERT_TRUE(s->DoString("objs, values = nil, nil", "clear"));
+    s->Gc();
+    ASSERT_TRUE(s->DoString(R"(
+        for i = 1, 20000 do assert(get_obj(i).int_val == i and new_value(i).int_val == i) end
+    )", "again"));
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestGcStep) {
+    static constexpr const char* script_frame = R"(
+        local keep = {}
+        return function (frame)
+            for i = 1, 2000 do
+                local t = {i, tostring(i)}
+                if i % 100 == 0 then keep[(frame * 20 + i // 100) % 4000 + 1] = t end
+            end
+        end
+    )";
+
+    // frame time percentiles, full gc every 60 frames vs budgeted gc steps every frame
+    auto run = [](xlua::State* s, bool step, std::vector<long long>& times) {
+        xlua::Function func;
+        s->DoString(script_frame, "frame", std::tie(func));
+        for (int frame = 1; frame <= 600; ++frame) {
+            auto start = std::chrono::steady_clock::now();
+            func(std::tie(), frame);
+            if (step)
+                s->GcStep(1000);
+            else if (frame % 60 == 0)
+                s->Gc();
+            auto end = std::chrono::steady_clock::now();
+            times.push_back((long long)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+        }
+        std::sort(times.begin(), times.end());
+    };
+
+    auto percent = [](const std::vector<long long>& times, int p) {
+        return times[(times.size() - 1) * p / 100];
+    };
+
+    std::vector<long long> full_times;
+    xlua::State* s = xlua::Create(nullptr);
+    run(s, false, full_times);
+    s->Release();
+
+    std::vector<long long> step_times;
+    s = xlua::Create(nullptr);
+    s->SetGcAuto(false);
+    ASSERT_EQ(s->SetGcPause(150), 200);
+    ASSERT_EQ(s->SetGcStepMul(200), 200);
+    run(s, true, step_times);
+
+    auto stats = s->GetGcStats();
+    ASSERT_GT(stats.steps, 0);
+    ASSERT_GT(stats.cycles, 0);
+    ASSERT_GT(stats.freed, 0);
+    ASSERT_GE(stats.max_us, stats.last_us);
+    // one slice stays inside a small multiple of the budget, allow rare preemption of the test process
+    ASSERT_LT(stats.max_slice_us, 10 * 1000);
+    ASSERT_LE(stats.over_slices * 100, stats.steps);
+    // the budgeted steps keep up with the allocation
+    ASSERT_LT(lua_gc(s->GetLuaState(), LUA_GCCOUNT, 0), 64 * 1024);
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+
+    printf("frame time(us) p50/p95/p99/max, full gc: %lld/%lld/%lld/%lld, gc step: %lld/%lld/%lld/%lld\n",
+        percent(full_times, 50), percent(full_times, 95), percent(full_times, 99), full_times.back(),
+        percent(step_times, 50), percent(step_times, 95), percent(step_times, 99), step_times.back());
+    printf("gc step: %u steps, %u cycles, %u KB freed, %lld us total, max slice %lld us, %u slices over budget\n",
+        (unsigned)stats.steps, (unsigned)stats.cycles, (unsigned)(stats.freed / 1024), (long long)stats.total_us,
+        (long long)stats.max_slice_us, (unsigned)stats.over_slices);
+}
+
+TEST(xlua, TestDeferDestruct) {
+    xlua::State* s = xlua::Create(nullptr);
+    ASSERT_EQ(DeferLifeTime::s_counter, 0);
+
+    // the opt-in type is moved to the deferred queue on gc
+    for (int i = 0; i < 100; ++i) {
+        s->Push(DeferLifeTime());
+        s->PopTop(1);
+    }
+    s->Gc();
+    ASSERT_EQ(s->GetDeferredCount(), 100);
+    ASSERT_EQ(DeferLifeTime::s_counter, 100);
+    ASSERT_EQ(s->DrainDeferred(40), 40);
+    ASSERT_EQ(DeferLifeTime::s_counter, 60);
+    ASSERT_EQ(s->DrainDeferred(), 60);
+    ASSERT_EQ(DeferLifeTime::s_counter, 0);
+
+    // other types are destroyed inline
+    s->Push(LifeTime());
+    s->PopTop(1);
+    s->Gc();
+    ASSERT_EQ(LifeTime::s_counter, 0);
+    ASSERT_EQ(s->GetDeferredCount(), 0);
+
+    // global mode
+    int deleted = 0;
+    s->SetDeferDestruct(true);
+    s->Push(std::shared_ptr<Triangle>(new Triangle, [&deleted](Triangle* p) { ++deleted; delete p; }));
+    s->PopTop(1);
+    s->Gc();
+    ASSERT_EQ(deleted, 0);
+    ASSERT_EQ(s->GetDeferredCount(), 1);
+
+    // destroy at background thread
+    xlua::DeferredBatch batch = s->TakeDeferred();
+    ASSERT_EQ(s->GetDeferredCount(), 0);
+    ASSERT_EQ(batch.Size(), 1);
+    std::thread([&batch]() { batch.Clear(); }).join();
+    ASSERT_EQ(deleted, 1);
+
+    // the payload collected by close holds a lua ref, destroyed before the lua state closed
+    s->NewTable();
+    auto table = s->Get<xlua::Table>(-1);
+    s->PopTop(1);
+    s->SetGlobal("deferred_obj", std::shared_ptr<Triangle>(new Triangle, [table, &deleted](Triangle* p) {
+        ++deleted;
+        delete p;
+    }));
+    table = nullptr;
+
+    // the payloads left in queue are destroyed with the state
+    s->Push(DeferLifeTime());
+    s->PopTop(1);
+    s->Gc();
+    ASSERT_EQ(DeferLifeTime::s_counter, 1);
+    s->Release();
+    ASSERT_EQ(DeferLifeTime::s_counter, 0);
+    ASSERT_EQ(deleted, 2);
+}
+
+TEST(xlua, TestGcBatchFlush) {
+    xlua::State* s = xlua::Create(nullptr);
+    std::vector<std::shared_ptr<Triangle>> objs;
+    for (int i = 0; i < 10000; ++i)
+        objs.push_back(std::make_shared<Triangle>());
+
+    for (auto& obj : objs) {
+        s->Push(obj);
+        s->PopTop(1);
+    }
+
+    // lua collect without flush, the dead caches are pending
+    auto start = std::chrono::steady_clock::now();
+    lua_gc(s->GetLuaState(), LUA_GCCOLLECT, 0);
+    auto end = std::chrono::steady_clock::now();
+
+    // push the same objects again, must not hit the dead caches
+    for (size_t i = objs.size() - 100; i < objs.size(); ++i) {
+        s->Push(objs[i]);
+        ASSERT_EQ(s->Get<std::shared_ptr<Triangle>>(-1), objs[i]);
+        s->Push(objs[i]);
+        ASSERT_TRUE(lua_rawequal(s->GetLuaState(), -1, -2));
+        s->PopTop(2);
+    }
+    s->Gc();
+    ASSERT_EQ(objs.back().use_count(), 1);
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+
+    printf("gc 10000 smart ptr userdata: %lld us\n",
+        (long long)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+}
+
+TEST(xlua, TestCallStats) {
+    static constexpr const char* script = R"(
+        return function (t, n)
+            local s = 0
+            for i = 1, n do
+                t.line_1 = i
+                s = s + t:AreaSize()
+            end
+            pcall(t.AreaSize, 1)                            -- obj is nil
+            pcall(function () t.line_1 = "error" end)       -- parameter is not accepted
+            return s
+        end
+    )";
+
+    xlua::State* s = xlua::Create(nullptr);
+    Triangle tri;
+    {
+        xlua::Function func;
+        ASSERT_TRUE(s->DoString(script, "call_stats", std::tie(func)));
+        ASSERT_TRUE(func(std::tie(), &tri, 1000));
+    }
+
+#if XLUA_ENABLE_CALL_STATS
+    auto find = [](const std::vector<xlua::CallStat>& stats, const char* type, const char* name) {
+        for (const auto& stat : stats) {
+            if (strcmp(stat.type, type) == 0 && strcmp(stat.name, name) == 0)
+                return stat;
+        }
+        return xlua::CallStat();
+    };
+
+    auto stats = s->GetCallStats();
+    auto area = find(stats, "Triangle", "AreaSize");
+    ASSERT_EQ(area.calls, 1001);
+    ASSERT_EQ(area.failed, 1);
+    ASSERT_GE(area.max_ns, 0);
+    uint64_t hist = 0;
+    for (uint32_t count : area.hist)
+        hist += count;
+    ASSERT_EQ(hist, 1000);      // the failed call not reach the end
+
+    auto line = find(stats, "Triangle", "line_1.set");
+    ASSERT_EQ(line.calls, 1001);
+    ASSERT_EQ(line.failed, 1);
+
+    std::string text = s->DumpCallStats();
+    ASSERT_NE(text.find("Triangle.AreaSize"), std::string::npos);
+    std::string csv = s->DumpCallStats(true);
+    ASSERT_EQ(csv.find("type,name,calls,failed"), 0);
+    ASSERT_NE(csv.find("Triangle,line_1.set,1001,1,"), std::string::npos);
+    printf("%s", text.c_str());
+
+    s->ResetCallStats();
+    ASSERT_TRUE(s->GetCallStats().empty());
+#else
+    ASSERT_TRUE(s->GetCallStats().empty());
+#endif // XLUA_ENABLE_CALL_STATS
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestProfiler) {
+    static constexpr const char* script = R"(
+        local function leaf(n)
+            local s = 0
+            for i = 1, n do s = s + i end
+            return s
+        end
+
+        local function branch(n)
+            return leaf(n) + leaf(n)
+        end
+
+        return function (t, n)
+            local s = 0
+            for i = 1, n do
+                s = s + branch(100) + t:AreaSize()
+            end
+            return s
+        end
+    )";
+
+    xlua::State* s = xlua::Create(nullptr);
+    Triangle tri;
+    {
+        xlua::Function func;
+        ASSERT_TRUE(s->DoString(script, "profiler", std::tie(func)));
+
+        xlua::ProfilerConfig config;
+        config.count = 100;
+        config.interval_us = 0;
+        ASSERT_TRUE(s->StartProfiler(config));
+        ASSERT_TRUE(func(std::tie(), &tri, 2000));
+        s->StopProfiler();
+
+        uint64_t samples = s->GetProfileSamples();
+        ASSERT_GT(samples, 0);
+        ASSERT_TRUE(func(std::tie(), &tri, 100));
+        ASSERT_EQ(s->GetProfileSamples(), samples);  // stopped
+    }
+
+    const char* file = "xlua_profile.folded";
+    ASSERT_TRUE(s->WriteProfile(file));
+    std::string folded;
+    if (FILE* fp = fopen(file, "r")) {
+        char buff[1024];
+        while (fgets(buff, sizeof(buff), fp))
+            folded += buff;
+        fclose(fp);
+    }
+    remove(file);
+
+    ASSERT_NE(folded.find("branch@"), std::string::npos);
+    ASSERT_NE(folded.find(";leaf@"), std::string::npos);
+
+    // the coroutine created before start is hooked when resumed by the scheduler
+    ASSERT_TRUE(s->DoString(R"(
+        coroutine.wrap(function ()
+            xlua.WaitFrames(1)
+            local s = 0
+            for i = 1, 100000 do s = s + i end
+        end)()
+    )", "profiler_co"));
+    xlua::ProfilerConfig config;
+    config.count = 100;
+    config.interval_us = 0;
+    ASSERT_TRUE(s->StartProfiler(config));
+    s->Tick(1);
+    s->Tick(2);
+    s->StopProfiler();
+    ASSERT_GT(s->GetProfileSamples(), 0);
+
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestHeapProfiler) {
+    static constexpr const char* script = R"(
+        return function (n)
+            local t = {}
+            for i = 1, n do
+                t[i] = {i, tostring(i)}
+            end
+            return #t
+        end
+    )";
+
+    xlua::State* s = xlua::Create(nullptr);
+    {
+        xlua::Function func;
+        ASSERT_TRUE(s->DoString(script, "heap", std::tie(func)));
+
+        for (int i = 0; i < 3; ++i)
+            s->Push(Triangle());    // created before start, the collection is not counted
+        s->PopTop(3);
+
+        xlua::HeapProfilerConfig config;
+        config.sample_bytes = 1024;
+        ASSERT_TRUE(s->StartHeapProfiler(config));
+        ASSERT_TRUE(func(std::tie(), 20000));
+
+        std::vector<std::shared_ptr<Triangle>> objs;
+        for (int i = 0; i < 10; ++i) {
+            objs.push_back(std::make_shared<Triangle>());
+            s->Push(objs.back());
+        }
+        for (int i = 0; i < 5; ++i)
+            s->Push(Triangle());
+        s->PopTop(15);
+
+        auto sites = s->GetAllocSites();
+        ASSERT_FALSE(sites.empty());
+        ASSERT_STREQ(sites[0].site, "[string \"heap\"]:5");
+        ASSERT_EQ(sites[0].bytes, sites[0].samples * config.sample_bytes);
+
+        auto stats = s->GetUdStats();
+        ASSERT_EQ(stats.size(), 1);
+        ASSERT_STREQ(stats[0].type, "Triangle");
+        ASSERT_EQ(stats[0].created[xlua::UdStat::kSmartPtr], 10);
+        ASSERT_EQ(stats[0].created[xlua::UdStat::kValue], 5);
+        ASSERT_EQ(stats[0].live[xlua::UdStat::kValue], 5);
+
+        s->Gc();
+        stats = s->GetUdStats();
+        ASSERT_EQ(stats[0].live[xlua::UdStat::kSmartPtr], 0);
+        ASSERT_EQ(stats[0].live[xlua::UdStat::kValue], 0);
+        s->StopHeapProfiler();
+        s->Push(Triangle());    // stopped
+        s->PopTop(1);
+        ASSERT_EQ(s->GetUdStats()[0].created[xlua::UdStat::kValue], 5);
+        printf("%s", s->DumpHeapProfile().c_str());
+    }
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestPushStats) {
+    xlua::State* s = xlua::Create(nullptr);
+    Triangle tri;
+    auto ptr = std::make_shared<Triangle>();
+
+    s->ResetPushStats();
+    s->Push(&tri);
+    s->Push(&tri);
+    s->Push(ptr);
+    s->Push(ptr);
+    s->Push(Triangle());
+    s->Push(s->Get<Triangle*>(-1));     // lua owned object
+    s->PopTop(6);
+
+    const auto& stats = s->GetPushStats();
+#if XLUA_ENABLE_LUD_OPTIMIZE
+    ASSERT_EQ(stats.lud, 2);
+    ASSERT_EQ(stats.lud_fallback, 0);
+#else
+    /* triangle is an extend weak object, it is cached by the weak object path */
+    ASSERT_EQ(stats.ptr_miss + stats.weak_miss, 1);
+    ASSERT_EQ(stats.ptr_hit + stats.weak_hit, 1);
+#endif // XLUA_ENABLE_LUD_OPTIMIZE
+    ASSERT_EQ(stats.smart_miss, 1);
+    ASSERT_EQ(stats.smart_hit, 1);
+    ASSERT_EQ(stats.value_new, 1);
+    ASSERT_EQ(stats.value_hit, 1);
+
+    s->ResetPushStats();
+    ASSERT_EQ(s->GetPushStats().smart_hit, 0);
+
+    /* the caches are released after the userdata collected */
+    ASSERT_EQ(s->GetCacheStats().smart_ptr_uds, 1);
+    s->Gc();
+    auto caches = s->GetCacheStats();
+    ASSERT_EQ(caches.smart_ptr_uds, 0);
+    ASSERT_EQ(caches.value_uds, 0);
+    ASSERT_EQ(caches.declared_ptr_uds + caches.weak_obj_uds, 0);
+    ASSERT_EQ(s->GetTop(), 0);
+    s->Release();
+}
+
+TEST(xlua, TestKey) {
+    static const xlua::Key k_name("name");
+    static const xlua::Key k_count("count");
+    xlua::State* s = xlua::Create(nullptr);
+    xlua::State* s2 = xlua::Create(nullptr);
+
+    s->NewTable();
+    ASSERT_TRUE(s->SetField(-1, k_name, "xlua"));
+    ASSERT_TRUE(s->SetField(-1, k_count, 3));
+    ASSERT_EQ(s->GetField<int>(-1, "count"), 3);
+    ASSERT_EQ(s->GetField<std::string>(-1, k_name), "xlua");
+    ASSERT_EQ(s->LoadField(-1, k_count), xlua::VarType::kNumber);
+    s->PopTop(1);
+
+    auto table = s->Get<xlua::Table>(-1);
+    s->PopTop(1);
+    ASSERT_EQ(s->GetTop(), 0);
+    ASSERT_EQ(table.GetField<int>(k_count), 3);
+    table.SetField(k_count, 4);
+    ASSERT_EQ(table.GetField<int>("count"), 4);
+
+    /* the key is interned by each state */
+    s2->NewTable();
+    s2->SetField(-1, k_count, 5);
+    ASSERT_EQ(s2->GetField<int>(-1, k_count), 5);
+    s2->PopTop(1);
+    ASSERT_EQ(table.GetField<int>(k_count), 4);
+
+    /* the keys with same string share the id and the pinned lua string */
+    for (int i = 0; i < 10; ++i)
+        ASSERT_EQ(table.GetField<int>(xlua::Key("count")), 4);
+    ASSERT_EQ(xlua::Key("count").GetId(), k_count.GetId());
+    ASSERT_NE(xlua::Key("count", 3).GetId(), k_count.GetId());
+
+    ASSERT_EQ(s->GetTop(), 0);
+    ASSERT_EQ(s2->GetTop(), 0);
+    table = nullptr;
+    s2->Release();
+    s->Release();
+}
+
 TEST(xlua, TestProgram) {
     //TODO:
 }
@@ -0,0 +1,248 @@
+#!/usr/bin/env python
+""" xlua binding generator
+usage: xlua_gen.py [-o out.cpp] [--class Name ...] [--exclude Class::member ...] [--check] header.h ...
+
+the classes declared by XLUA_DECLARE_CLASS in the headers (or named by --class) are exported,
+public variates and functions are emitted as XLUA_EXPORT_CLASS_BEGIN blocks.
+the structs declared by XLUA_DECLARE_STRUCT are emitted as XLUA_EXPORT_STRUCT_BEGIN blocks,
+with the public non-static variates as fields.
+members the parser can not understand are skipped and reported on stderr,
+members of the type xlua does not support should be excluded explicitly.
+"""
+
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import CppHeaderParser
+
+DECLARE_RE = re.compile(r'\bXLUA_DECLARE_CLASS\s*\(\s*([\w:]+)\s*\)')
+STRUCT_RE = re.compile(r'\bXLUA_DECLARE_STRUCT\s*\(\s*([\w:]+)\s*\)')
+IDENT_RE = re.compile(r'^[A-Za-z_]\w*$')
+IGNORE_VARS = ('XLUA_DECLARE_OBJ_INDEX',)
+
+
+def read_source(path):
+    with open(path, 'r', encoding='utf-8-sig') as f:
+        return f.read()
+
+
+def full_name(cls):
+    ns = cls['namespace'].strip(':')
+    return ns + '::' + cls['name'] if ns else cls['name']
+
+
+def param_type(param):
+    t = param['type']
+    if param.get('reference') or param.get('name', '').startswith('&'):
+        t += '&'
+    return t.replace(' *', '*').replace(' &', '&')
+
+
+def is_valid_type(t):
+    return t and '(' not in t and ')' not in t and 'CppHeaderParser' not in t
+
+
+def export_class(cls, name, super_name, excludes, skipped):
+    lines = []
+    if super_name:
+        lines.append('XLUA_EXPORT_CLASS_BEGIN(%s, %s)' % (name, super_name))
+    else:
+        lines.append('XLUA_EXPORT_CLASS_BEGIN(%s)' % name)
+
+    for var in cls['properties']['public']:
+        vname = var['name']
+        vtype = var['type']
+        if vtype.strip() in IGNORE_VARS or '%s::%s' % (name, vname) in excludes:
+            continue
+        if not IDENT_RE.match(vname or '') or not is_valid_type(vtype):
+            skipped.append('%s: variate "%s %s"' % (name, vtype, vname))
+            continue
+        if var.get('reference') or '&' in vtype:
+            skipped.append('%s::%s: reference variate' % (name, vname))
+            continue
+        if var.get('constant') or vtype.replace('static ', '').startswith('const '):
+            lines.append('XLUA_VARIATE_R(%s::%s)' % (name, vname))
+        else:
+            lines.append('XLUA_VARIATE(%s::%s)' % (name, vname))
+
+    funcs = []
+    for func in cls['methods']['public']:
+        if func['constructor'] and func['name'] != cls['name']:
+            skipped.append('%s: unknown macro %s, the declarations it swallows are lost' % (name, func['name']))
+            continue
+        if func['constructor'] or func['destructor'] or func['operator'] or func['template'] or func['friend']:
+            continue
+        fname = func['name']
+        if '%s::%s' % (name, fname) in excludes:
+            continue
+        params = [param_type(p) for p in func['parameters']]
+        if not IDENT_RE.match(fname) or not all(is_valid_type(p) for p in params):
+            skipped.append('%s::%s: function signature' % (name, fname))
+            continue
+        funcs.append((fname, params, func['const']))
+
+    # overloaded functions are exported as Name_1, Name_2 ... with the parameter types
+    counts = {}
+    for fname, _, _ in funcs:
+        counts[fname] = counts.get(fname, 0) + 1
+    index = {}
+    for fname, params, _ in funcs:
+        if counts[fname] == 1:
+            lines.append('XLUA_FUNCTION(%s::%s)' % (name, fname))
+        else:
+            index[fname] = index.get(fname, 0) + 1
+            args = ', '.join(params)
+            if args:
+                lines.append('XLUA_FUNCTION_AS(%s_%d, %s::%s, %s)' % (fname, index[fname], name, fname, args))
+            else:
+                lines.append('XLUA_FUNCTION_AS(%s_%d, %s::%s)' % (fname, index[fname], name, fname))
+
+    lines.append('XLUA_EXPORT_CLASS_END()')
+    return lines
+
+
+def export_struct(cls, name, excludes, skipped):
+    lines = ['XLUA_EXPORT_STRUCT_BEGIN(%s)' % name]
+    for var in cls['properties']['public']:
+        vname = var['name']
+        vtype = var['type']
+        if vtype.strip() in IGNORE_VARS or '%s::%s' % (name, vname) in excludes or var.get('static'):
+            continue
+        if not IDENT_RE.match(vname or '') or not is_valid_type(vtype):
+            skipped.append('%s: field "%s %s"' % (name, vtype, vname))
+            continue
+        if var.get('reference') or '&' in vtype or var.get('constant') or vtype.startswith('const '):
+            skipped.append('%s::%s: const or reference field' % (name, vname))
+            continue
+        lines.append('XLUA_FIELD(%s::%s)' % (name, vname))
+    lines.append('XLUA_EXPORT_STRUCT_END()')
+    return lines
+
+
+def generate(headers, out_path, names, excludes):
+    declared = list(names)
+    structs = []
+    classes = {}
+    order = []
+    defined_in = {}
+    for path in headers:
+        src = read_source(path)
+        for m in DECLARE_RE.finditer(src):
+            if m.group(1) not in declared:
+                declared.append(m.group(1))
+        for m in STRUCT_RE.finditer(src):
+            if m.group(1) not in structs:
+                structs.append(m.group(1))
+
+        parsed = CppHeaderParser.CppHeader(src, argType='string')
+        for cls in parsed.classes.values():
+            if cls.get('parent'):
+                continue    # nested class
+            name = full_name(cls)
+            if name not in classes:
+                classes[name] = cls
+                order.append(name)
+                defined_in[name] = path
+
+    skipped = []
+    exported = [n for n in order if n in declared]
+    for n in declared + structs:
+        if n not in classes:
+            skipped.append('%s: definition not found' % n)
+
+    out_dir = os.path.dirname(os.path.abspath(out_path)) if out_path else os.getcwd()
+    lines = ['/* generated by xlua_gen.py, do not edit */']
+    for path in headers:
+        rel = os.path.relpath(os.path.abspath(path), out_dir).replace('\\', '/')
+        lines.append('#include "%s"' % rel)
+    lines.append('#include <xlua_export.h>')
+    lines.append('')
+
+    # base class is exported first
+    done = set()
+
+    def emit(name):
+        if name in done:
+            return
+        done.add(name)
+        cls = classes[name]
+        super_name = None
+        for base in cls['inherits']:
+            base_name = base['class']
+            # struct inherits publicly by default, the parser does not know
+            if base['access'] != 'public' and cls['declaration_method'] != 'struct':
+                continue
+            if base_name not in exported and base_name not in declared:
+                ns = cls['namespace'].strip(':')
+                base_name = ns + '::' + base_name if ns else base_name
+            if base_name not in exported and base_name not in declared:
+                skipped.append('%s: base class %s is not declared, its members and casts are lost' % (name, base['class']))
+            elif super_name is None:
+                super_name = base_name
+            else:
+                skipped.append('%s: only one super class is exported, base %s is dropped' % (name, base_name))
+        if super_name in exported:
+            emit(super_name)
+        lines.extend(export_class(cls, name, super_name, excludes, skipped))
+        lines.append('')
+
+    for name in exported:
+        emit(name)
+
+    for name in order:
+        if name in structs:
+            lines.extend(export_struct(classes[name], name, excludes, skipped))
+            lines.append('')
+    return '\n'.join(lines), skipped
+
+
+def main(argv):
+    out_path = None
+    names = []
+    excludes = set()
+    check = False
+    headers = []
+    i = 0
+    while i < len(argv):
+        arg = argv[i]
+        if arg == '-o':
+            i += 1
+            out_path = argv[i]
+        elif arg == '--class':
+            i += 1
+            names.append(argv[i])
+        elif arg == '--exclude':
+            i += 1
+            excludes.add(argv[i])
+        elif arg == '--check':
+            check = True
+        else:
+            headers.append(arg)
+        i += 1
+
+    if not headers:
+        print(__doc__)
+        return 1
+
+    text, skipped = generate(headers, out_path, names, excludes)
+    for s in skipped:
+        sys.stderr.write('skip %s\n' % s)
+
+    if check:
+        if not out_path or not os.path.exists(out_path) or read_source(out_path) != text:
+            sys.stderr.write('%s is out of date\n' % out_path)
+            return 1
+        return 0
+
+    if out_path:
+        with open(out_path, 'w', encoding='utf-8', newline='\n') as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
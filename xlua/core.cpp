@@ -1,5 +1,11 @@
 #include "xlua_state.h"
 #include "xlua_export.h"
+#include <stdlib.h>
+#include <stdarg.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
 
 XLUA_NAMESPACE_BEGIN
 
@@ -72,12 +78,219 @@ namespace internal {
         AllocNode* alloc_node_;
     };
 
-    struct ArrayObj {
-        union {
-            void* ptr;  // cache object ptr
-            int next;   // when slot is empty, next empty slot position
+    /* size-class pool allocator for lua state
+     * small blocks are carved from arenas and recycled by free lists,
+     * the arenas are released in bulk when the allocator is destroyed
+    */
+    class PoolAlloc {
+        struct Block {
+            Block* next;
+        };
+
+        struct Arena {
+            Arena* next;
         };
-        int serial;
+
+    public:
+        static constexpr size_t kArenaSize = 64 * 1024;
+        static constexpr size_t kMaxSmall = AllocStats::kClassStep * AllocStats::kClassNum;
+        /* the blocks start after the arena header, keep them aligned as malloc */
+        static constexpr size_t kAlign = alignof(std::max_align_t);
+        static constexpr size_t kArenaHead = (sizeof(Arena) + kAlign - 1) / kAlign * kAlign;
+        static_assert(AllocStats::kClassStep % kAlign == 0, "size class step must keep the alignment");
+
+    public:
+        PoolAlloc(MemBudget* budget) : budget_(budget) {}
+        ~PoolAlloc() {
+            while (arena_) {
+                auto* next = arena_->next;
+                ::free(arena_);
+                arena_ = next;
+            }
+        }
+
+        PoolAlloc(const PoolAlloc&) = delete;
+        PoolAlloc& operator = (const PoolAlloc&) = delete;
+
+    public:
+        static void* LuaAlloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+            return static_cast<PoolAlloc*>(ud)->Realloc(ptr, osize, nsize);
+        }
+
+        void* Realloc(void* ptr, size_t osize, size_t nsize) {
+            if (ptr == nullptr)
+                osize = 0;  // osize is the lua type of new object
+
+            if (nsize == 0) {
+                Free(ptr, osize);
+                return nullptr;
+            }
+
+            // over budget, the shrink is always allowed
+            if (budget_->limit && budget_->protect && nsize > osize &&
+                stats_.live + budget_->xlua + (nsize - osize) > budget_->limit)
+                return nullptr;
+
+            if (ptr) {
+                if (osize > kMaxSmall && nsize > kMaxSmall) {
+                    void* p = ::realloc(ptr, nsize);
+                    if (p)
+                        Update(nsize, osize);
+                    return p;
+                } else if (nsize <= kMaxSmall && ClassIndex(osize) == ClassIndex(nsize)) {
+                    Update(nsize, osize);
+                    return ptr;
+                }
+            }
+
+            void* p = Alloc(nsize);
+            if (p && ptr) {
+                ::memcpy(p, ptr, osize < nsize ? osize : nsize);
+                Free(ptr, osize);
+            }
+            return p;
+        }
+
+        inline const AllocStats& Stats() const { return stats_; }
+
+    private:
+        static inline int ClassIndex(size_t size) {
+            return (int)((size + AllocStats::kClassStep - 1) / AllocStats::kClassStep) - 1;
+        }
+
+        inline void Update(size_t add, size_t sub) {
+            stats_.live = stats_.live + add - sub;
+            if (stats_.live > stats_.peak)
+                stats_.peak = stats_.live;
+        }
+
+        void* Alloc(size_t size) {
+            void* p = nullptr;
+            if (size > kMaxSmall) {
+                p = ::malloc(size);
+                if (p)
+                    ++stats_.large_count;
+            } else {
+                int idx = ClassIndex(size);
+                if (Block* block = free_[idx]) {
+                    free_[idx] = block->next;
+                    p = block;
+                } else {
+                    p = Carve((idx + 1) * AllocStats::kClassStep);
+                }
+                if (p)
+                    ++stats_.class_count[idx];
+            }
+
+            if (p)
+                Update(size, 0);
+            return p;
+        }
+
+        void Free(void* ptr, size_t size) {
+            if (ptr == nullptr)
+                return;
+
+            if (size > kMaxSmall) {
+                ::free(ptr);
+                --stats_.large_count;
+            } else {
+                int idx = ClassIndex(size);
+                auto* block = static_cast<Block*>(ptr);
+                block->next = free_[idx];
+                free_[idx] = block;
+                --stats_.class_count[idx];
+            }
+            Update(0, size);
+        }
+
+        void* Carve(size_t size) {
+            if (cursor_ + size > end_) {
+                auto* arena = static_cast<Arena*>(::malloc(kArenaSize));
+                if (arena == nullptr)
+                    return nullptr;
+
+                arena->next = arena_;
+                arena_ = arena;
+                cursor_ = reinterpret_cast<int8_t*>(arena) + kArenaHead;
+                end_ = reinterpret_cast<int8_t*>(arena) + kArenaSize;
+                stats_.arena += kArenaSize;
+            }
+
+            void* p = cursor_;
+            cursor_ += size;
+            return p;
+        }
+
+    private:
+        MemBudget* budget_;
+        Arena* arena_ = nullptr;
+        int8_t* cursor_ = nullptr;
+        int8_t* end_ = nullptr;
+        Block* free_[AllocStats::kClassNum] = {nullptr};
+        AllocStats stats_;
+    };
+
+    AllocStats GetAllocStats(const PoolAlloc* alloc, const MemBudget& budget) {
+        AllocStats stats = alloc ? alloc->Stats() : AllocStats();
+        stats.limit = budget.limit;
+        stats.xlua = budget.xlua;
+        return stats;
+    }
+
+    /* grow-only slot array shared by the states of all threads, the readers never lock
+     * a chunk is installed on the first use and never moved until exit
+    */
+    template <typename Ty, size_t kChunkSize, size_t kChunkNum>
+    class SlotArray {
+    public:
+        static constexpr size_t kCapacity = kChunkSize * kChunkNum;
+
+        SlotArray() {
+            for (auto& chunk : chunks_)
+                chunk.store(nullptr, std::memory_order_relaxed);
+        }
+        ~SlotArray() {
+            for (auto& chunk : chunks_)
+                delete[] chunk.load(std::memory_order_relaxed);
+        }
+        SlotArray(const SlotArray&) = delete;
+        void operator = (const SlotArray&) = delete;
+
+    public:
+        /* nullptr if the chunk of the slot is not installed */
+        inline Ty* Get(size_t index) const {
+            if (index >= kCapacity)
+                return nullptr;
+            Ty* chunk = chunks_[index / kChunkSize].load(std::memory_order_acquire);
+            return chunk ? &chunk[index % kChunkSize] : nullptr;
+        }
+
+        /* install the chunk of the slot if need, nullptr if out of capacity */
+        Ty* Alloc(size_t index) {
+            if (index >= kCapacity)
+                return nullptr;
+
+            auto& slot = chunks_[index / kChunkSize];
+            Ty* chunk = slot.load(std::memory_order_acquire);
+            if (chunk == nullptr) {
+                Ty* fresh = new Ty[kChunkSize]();
+                if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+                    chunk = fresh;
+                else
+                    delete[] fresh;     // installed by other thread
+            }
+            return &chunk[index % kChunkSize];
+        }
+
+    private:
+        std::atomic<Ty*> chunks_[kChunkNum];
+    };
+
+    struct WeakObjSlot {
+        std::atomic<void*> ptr{nullptr};
+        std::atomic<int> serial{0};     // 0 is a free slot
+        int next = 0;                   // next free slot, guarded by the alloc mutex
     };
 
     struct LudType {
@@ -94,46 +307,36 @@ namespace internal {
         };
     };
 
-    struct ExportVar {
-        const char* name;
-        LuaIndexer getter;
-        LuaIndexer setter;
-    };
-
-    struct ExportFunc {
-        const char* name;
-        LuaFunction func;
-    };
-
-    struct TypeVar {
-        size_t len;
-        ExportVar* data;
-    };
-
-    struct TypeFunc {
-        size_t len;
-        ExportFunc* data;
-    };
-
     struct TypeData : TypeDesc {
-        TypeVar member_vars;
-        TypeVar global_vars;
-        TypeFunc member_funcs;
-        TypeFunc global_funcs;
+        const ExportMember* members;    // member table, terminated by kNone
+        bool is_global;                 // global table, all members are global
+        size_t var_num[2];              // [member, global]
+        size_t func_num[2];
     };
 
+    static inline bool IsGlobal(const TypeData& td, const ExportMember& member) {
+        return td.is_global || member.global;
+    }
+
     static constexpr int kMaxLudIndex = 0xff;
 
 #if XLUA_ENABLE_LUD_OPTIMIZE
     struct LudWeakData {
-        const TypeDesc* desc;
-        int serial;
+        std::atomic<const TypeDesc*> desc{nullptr};
+        std::atomic<int> serial{0};
     };
+    typedef SlotArray<LudWeakData, 4096, (kMaxLudObjIndex + 1) / 4096> LudWeakArray;
 #endif // XLUA_ENABLE_LUD_OPTIMIZE
 
     /* xlua env data */
     struct Env{
         Env() = default;
+#if XLUA_ENABLE_LUD_OPTIMIZE
+        ~Env() {
+            for (auto& ary : declared.lua_weak_data_list)
+                delete ary.load(std::memory_order_relaxed);
+        }
+#endif // XLUA_ENABLE_LUD_OPTIMIZE
         Env(const Env&) = delete;
         void operator = (const Env&) = delete;
 
@@ -143,25 +346,59 @@ namespace internal {
 
 #if XLUA_ENABLE_LUD_OPTIMIZE
             std::array<const TypeDesc*, 256> lud_list;
-            std::array<std::vector<LudWeakData>, 256> lua_weak_data_list;
+            std::array<std::atomic<LudWeakArray*>, 256> lua_weak_data_list{};   // created on the first use
 #endif // XLUA_ENABLE_LUD_OPTIMIZE
         } declared;
 
         struct {
+            std::mutex mutex;           // guard alloc and free, the readers never lock
             int serial_gener = 0;
             int empty_slot = 0;
-            std::vector<ArrayObj> objs{ArrayObj()};
+            int size = 1;               // slot 0 is reserved
+            SlotArray<WeakObjSlot, 4096, 65536> objs;
         } weak_obj_ary;
 
         SerialAlloc allocator{8*1024};
         std::vector<std::pair<lua_State*, State*>> state_list;
+
+        /* states may run on different threads, guard the state list */
+        std::mutex mutex;
+        std::atomic<uint32_t> state_serial{0};  // changed when the state list changed
     };
 
     /* seperate the global export node list */
     static ExportNode* g_node_head = nullptr;
+    static ExportNode* g_node_tail = nullptr;
     static Env g_env;
 
-    State* GetState(lua_State* l) {
+    /* last found state of the thread, invalid if the state list changed
+     * only the registered lua thread is cached, the address of dead coroutine may be reused by other state
+    */
+    struct StateCache {
+        uint32_t serial = 0;
+        lua_State* l = nullptr;
+        State* s = nullptr;
+    };
+    static thread_local StateCache t_state_cache;
+
+    static inline void AddState(lua_State* l, State* s) {
+        std::lock_guard<std::mutex> lock(g_env.mutex);
+        g_env.state_list.push_back(std::make_pair(l, s));
+        ++g_env.state_serial;
+    }
+
+    static inline void RemoveState(State* s) {
+        std::lock_guard<std::mutex> lock(g_env.mutex);
+        auto it = std::find_if(g_env.state_list.begin(), g_env.state_list.end(),
+            [s](const std::pair<lua_State*, State*>& pair) {
+            return pair.second == s;
+        });
+        g_env.state_list.erase(it);
+        ++g_env.state_serial;
+    }
+
+    static inline State* FindState(lua_State* l) {
+        std::lock_guard<std::mutex> lock(g_env.mutex);
         auto it = std::find_if(g_env.state_list.begin(), g_env.state_list.end(),
             [l](const std::pair<lua_State*, State*>& pair) {
             return pair.first == l;
@@ -169,17 +406,858 @@ namespace internal {
         return it == g_env.state_list.end() ? nullptr : it->second;
     }
 
+    /* find the xlua state of the lua thread, the running thread is switched by the call/resume entries */
+    State* GetState(lua_State* l) {
+        auto& cache = t_state_cache;
+        uint32_t serial = g_env.state_serial.load(std::memory_order_acquire);
+        State* s = nullptr;
+        if (cache.l == l && cache.serial == serial) {
+            s = cache.s;
+        } else {
+            // coroutine, find by the main thread
+            lua_rawgeti(l, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+            lua_State* main = lua_tothread(l, -1);
+            lua_pop(l, 1);
+
+            if (cache.l == main && cache.serial == serial) {
+                s = cache.s;
+            } else {
+                if ((s = FindState(main)) == nullptr && (s = FindState(l)) != nullptr)
+                    main = l;   // attached by the thread
+                if (s) {
+                    cache.serial = serial;
+                    cache.l = main;
+                    cache.s = s;
+                }
+            }
+        }
+        return s;
+    }
+
+    void WaitAsync(State* s, const std::shared_ptr<AsyncData>& data) {
+        lua_State* co = s->state_.l_;
+        lua_pushthread(co);                                 // keep the coroutine alive
+        int ref = luaL_ref(co, LUA_REGISTRYINDEX);
+
+        data->state = s;
+        data->co = co;
+        data->index = s->state_.async_ary_.Alloc(ref, data);
+    }
+
+    static void HookProfiler(State* s, lua_State* co);
+
+    /* resume the coroutine, the narg values are pushed on the coroutine stack */
+    static void ResumeThread(State* s, lua_State* running, lua_State* co, int narg) {
+        lua_State* resuming = s->state_.resuming_;
+        HookProfiler(s, co);
+        s->state_.l_ = co;
+        s->state_.resuming_ = co;
+        int protect = s->state_.budget_.protect++;
+        int ret = lua_resume(co, running, narg);
+        s->state_.budget_.protect = protect;
+        s->state_.resuming_ = resuming;
+        if (ret != LUA_OK && ret != LUA_YIELD) {
+            char stack[1024];
+            s->state_.l_ = co;
+            s->GetCallStack(stack, 1024);
+            Log(s, "resume coroutine failed: %s\n%s", lua_tostring(co, -1), stack);
+        }
+        if (ret != LUA_YIELD)
+            lua_settop(co, 0);
+        s->state_.l_ = running;
+    }
+
+    void CancelAsync(State* s, lua_State* co) {
+        auto& async_ary = s->state_.async_ary_;
+        for (int i = 1, c = async_ary.Size(); i < c; ++i) {
+            if (!async_ary.IsValid(i) || async_ary.GetValue(i)->co != co)
+                continue;
+
+            auto data = async_ary.GetValue(i);
+            luaL_unref(co, LUA_REGISTRYINDEX, async_ary.GetRef(i));
+            async_ary.Free(i);
+            data->state = nullptr;
+            data->co = nullptr;
+            data->index = 0;
+            return;
+        }
+    }
+
+    void Log(State* s, const char* fmt, ...) {
+        char buff[2048];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(buff, sizeof(buff), fmt, args);
+        va_end(args);
+
+        if (s->state_.log_)
+            s->state_.log_(buff);
+        else
+            printf("%s\n", buff);
+    }
+
+    void ResumeAsync(AsyncData* data) {
+        State* s = data->state;
+        if (s == nullptr)
+            return;
+
+        lua_State* co = data->co;
+        int ref = s->state_.async_ary_.GetRef(data->index);
+        auto hold = s->state_.async_ary_.GetValue(data->index);    // keep data alive while resuming
+        s->state_.async_ary_.Free(data->index);
+        data->state = nullptr;
+        data->co = nullptr;
+        data->index = 0;
+
+        lua_State* running = s->state_.l_;
+        s->state_.l_ = co;
+        lua_pushboolean(co, data->ok);
+        if (data->ok)
+            data->PushValue(s);
+        else
+            lua_pushstring(co, data->error.c_str());
+
+        ResumeThread(s, running, co, 2);
+        luaL_unref(running, LUA_REGISTRYINDEX, ref);
+    }
+
+    void TimerWheel::Add(WaitNode* node, uint64_t expire) {
+        node->expire = expire > now_ ? expire : now_ + 1;
+        Insert(node);
+        ++count_;
+    }
+
+    void TimerWheel::Insert(WaitNode* node) {
+        // the lowest level which the higher bits of expire and now are same
+        int level = 0;
+        while (level < kLevelNum - 1 &&
+            (node->expire >> (kSlotBits * (level + 1))) != (now_ >> (kSlotBits * (level + 1))))
+            ++level;
+
+        int slot = (int)((node->expire >> (kSlotBits * level)) & (kSlotNum - 1));
+        slots_[level][slot].PushBack(node);
+    }
+
+    void TimerWheel::Advance(uint64_t now, ListNode* ready) {
+        while (now_ < now) {
+            if (count_ == 0) {
+                now_ = now;
+                break;
+            }
+
+            ++now_;
+            // cascade the upper level slot when the lower levels turn around
+            for (int level = 1; level < kLevelNum; ++level) {
+                if ((now_ & ((1ull << (kSlotBits * level)) - 1)) != 0)
+                    break;
+
+                ListNode list;
+                list.Splice(&slots_[level][(now_ >> (kSlotBits * level)) & (kSlotNum - 1)]);
+                while (!list.Empty())
+                    Insert(static_cast<WaitNode*>(list.PopFront()));
+            }
+
+            auto& slot = slots_[0][now_ & (kSlotNum - 1)];
+            while (!slot.Empty()) {
+                ready->PushBack(slot.PopFront());
+                --count_;
+            }
+        }
+    }
+
+    void TimerWheel::Clear(ListNode* out) {
+        for (auto& level : slots_) {
+            for (auto& slot : level)
+                out->Splice(&slot);
+        }
+        count_ = 0;
+    }
+
+    Scheduler::~Scheduler() {
+        Clear(nullptr);
+        while (!free_.Empty())
+            delete static_cast<WaitNode*>(free_.PopFront());
+    }
+
+    WaitNode* Scheduler::AllocNode(lua_State* co) {
+        lua_pushthread(co);                                 // keep the coroutine alive
+        int ref = luaL_ref(co, LUA_REGISTRYINDEX);          // may raise memory error, take the node after it
+        WaitNode* node = free_.Empty() ? new WaitNode() : static_cast<WaitNode*>(free_.PopFront());
+        node->co = co;
+        node->ref = ref;
+        ++count_;
+        return node;
+    }
+
+    void Scheduler::FreeNode(WaitNode* node) {
+        node->co = nullptr;
+        node->ref = LUA_NOREF;
+        free_.PushBack(node);
+        --count_;
+    }
+
+    void Scheduler::WaitTime(lua_State* co, int64_t ms) {
+        timers_.Add(AllocNode(co), timers_.Now() + (ms > 0 ? ms : 0));
+    }
+
+    void Scheduler::WaitFrames(lua_State* co, int64_t frames) {
+        frames_.Add(AllocNode(co), frames_.Now() + (frames > 0 ? frames : 0));
+    }
+
+    void Scheduler::WaitSignal(lua_State* co, int64_t id) {
+        signals_[id].PushBack(AllocNode(co));
+    }
+
+    void Scheduler::Signal(int64_t id) {
+        auto it = signals_.find(id);
+        if (it == signals_.end())
+            return;
+
+        ready_.Splice(&it->second);
+        signals_.erase(it);
+    }
+
+    void Scheduler::Update(uint64_t now, ListNode* ready) {
+        if (!started_) {
+            started_ = true;
+            base_time_ = now;
+        }
+
+        frames_.Advance(frames_.Now() + 1, &ready_);
+        timers_.Advance(now > base_time_ ? now - base_time_ : 0, &ready_);
+        ready->Splice(&ready_);
+    }
+
+    void Scheduler::Clear(lua_State* l) {
+        ListNode nodes;
+        timers_.Clear(&nodes);
+        frames_.Clear(&nodes);
+        nodes.Splice(&ready_);
+        for (auto& pair : signals_)
+            nodes.Splice(&pair.second);
+        signals_.clear();
+
+        while (!nodes.Empty()) {
+            auto* node = static_cast<WaitNode*>(nodes.PopFront());
+            if (l)
+                luaL_unref(l, LUA_REGISTRYINDEX, node->ref);
+            FreeNode(node);
+        }
+    }
+
+    void TickScheduler(State* s, uint64_t now) {
+        auto& scheduler = s->state_.scheduler_;
+        ListNode ready;
+        scheduler.Update(now, &ready);
+
+        // the coroutine wait again is resumed at next tick
+        lua_State* running = s->state_.l_;
+        while (!ready.Empty()) {
+            auto* node = static_cast<WaitNode*>(ready.PopFront());
+            lua_State* co = node->co;
+            int ref = node->ref;
+            scheduler.FreeNode(node);
+
+            ResumeThread(s, running, co, 0);
+            luaL_unref(running, LUA_REGISTRYINDEX, ref);
+        }
+    }
+
+    static inline size_t GetGcBytes(lua_State* l) {
+        return (size_t)lua_gc(l, LUA_GCCOUNT, 0) * 1024 + (size_t)lua_gc(l, LUA_GCCOUNTB, 0);
+    }
+
+    bool GcStep(State* s, uint64_t budget_us) {
+        typedef std::chrono::steady_clock Clock;
+        auto& gc = s->state_.gc_;
+        auto& stats = gc.stats;
+        lua_State* l = s->state_.l_;
+        size_t bytes = GetGcBytes(l);
+
+        stats.alloc_rate = gc.last_bytes && bytes > gc.last_bytes ? bytes - gc.last_bytes : 0;
+        gc.last_bytes = bytes;
+
+        // keep the pause after a finished cycle
+        if (bytes < gc.threshold) {
+            stats.last_us = 0;
+            stats.last_freed = 0;
+            return false;
+        }
+
+        bool finish = false;
+        uint64_t used = 0;
+        uint64_t slice_ns = budget_us * 1000 / 4;   // one slice costs at most about 1/4 budget
+        auto begin = Clock::now();
+        auto last = begin;
+        while (true) {
+            // the slice size is derived from the measured cost, never from the allocation rate
+            size_t step_kb = gc.ns_per_kb ? (size_t)(slice_ns / gc.ns_per_kb) : GcControl::kMinStepKb;
+            if (step_kb < GcControl::kMinStepKb)
+                step_kb = GcControl::kMinStepKb;
+            else if (step_kb > GcControl::kMaxStepKb)
+                step_kb = GcControl::kMaxStepKb;
+            stats.step_kb = step_kb;
+
+            finish = lua_gc(l, LUA_GCSTEP, (int)step_kb) != 0;
+            ++stats.steps;
+
+            auto now = Clock::now();
+            uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+            used = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - begin).count();
+            last = now;
+            stats.max_slice_us = std::max(stats.max_slice_us, ns / 1000);
+            gc.cycle_slice_us = std::max(gc.cycle_slice_us, ns / 1000);
+            if (ns / 1000 > budget_us)
+                ++stats.over_slices;
+
+            // the cost differs by gc phase, rise fast and fall slowly, a single atomic slice moves it 4x at most
+            uint64_t cost = std::max<uint64_t>(ns / step_kb, 1);
+            if (gc.ns_per_kb == 0)
+                gc.ns_per_kb = cost;
+            else if (cost > gc.ns_per_kb)
+                gc.ns_per_kb = std::min(cost, gc.ns_per_kb * 4);
+            else
+                gc.ns_per_kb = (gc.ns_per_kb * 3 + cost) / 4;
+
+            if (finish || used >= budget_us)
+                break;
+        }
+
+        size_t after = GetGcBytes(l);
+        stats.last_freed = bytes > after ? bytes - after : 0;
+        stats.freed += stats.last_freed;
+        stats.last_us = used;
+        stats.total_us += used;
+        stats.max_us = std::max(stats.max_us, used);
+        gc.last_bytes = after;
+        s->state_.CheckFlushGc();
+        if (finish) {
+            // the atomic slice grows with the garbage of a cycle, start next cycle at once if it overran
+            ++stats.cycles;
+            gc.threshold = gc.cycle_slice_us > budget_us ? 0 : after / 100 * gc.pause;
+            gc.cycle_slice_us = 0;
+        }
+        return finish;
+    }
+
+    void SetGcAuto(State* s, bool enable) {
+        auto& gc = s->state_.gc_;
+        if (gc.auto_gc == enable)
+            return;
+
+        gc.auto_gc = enable;
+        lua_gc(s->state_.l_, enable ? LUA_GCRESTART : LUA_GCSTOP, 0);
+    }
+
+    /* sampling profiler, aggregate the folded stacks */
+    class Profiler {
+    public:
+        Profiler(const ProfilerConfig& config) : config_(config) {}
+
+    public:
+        inline bool IsRunning() const { return running_; }
+        inline void SetRunning(bool running) { running_ = running; }
+        inline uint64_t Samples() const { return samples_; }
+        inline int Count() const { return config_.count; }
+
+        void OnHook(lua_State* l) {
+            if (config_.interval_us) {
+                uint64_t now = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+                if (now - last_us_ < config_.interval_us)
+                    return;
+                last_us_ = now;
+            }
+            Sample(l);
+        }
+
+        bool Write(const char* file) const {
+            FILE* fp = fopen(file, "w");
+            if (fp == nullptr)
+                return false;
+
+            for (const auto& pair : stacks_)
+                fprintf(fp, "%s %llu\n", pair.first.c_str(), (unsigned long long)pair.second);
+            fclose(fp);
+            return true;
+        }
+
+    private:
+        void Sample(lua_State* l) {
+            lua_Debug dbg;
+            int depth = 0;
+            for (int level = 0; lua_getstack(l, level, &dbg); ++level) {
+                if (depth == config_.max_depth) {
+                    SetFrame(depth++, "...");
+                    break;
+                }
+
+                char buff[256];
+                lua_getinfo(l, "nS", &dbg);
+                if (*dbg.what == 'C')
+                    snprintf(buff, sizeof(buff), "[C]%s", dbg.name ? dbg.name : "?");
+                else if (*dbg.what == 'm')
+                    snprintf(buff, sizeof(buff), "main@%s", dbg.short_src);
+                else
+                    snprintf(buff, sizeof(buff), "%s@%s:%d", dbg.name ? dbg.name : "?", dbg.short_src, dbg.linedefined);
+                SetFrame(depth++, buff);
+            }
+
+            // root frame first
+            key_.clear();
+            for (int i = depth - 1; i >= 0; --i) {
+                key_ += frames_[i];
+                if (i)
+                    key_ += ';';
+            }
+
+            auto it = stacks_.find(key_);
+            if (it == stacks_.end()) {
+                if (stacks_.size() >= config_.max_stacks)
+                    key_ = "[other]";
+                it = stacks_.insert(std::make_pair(key_, 0)).first;
+            }
+            ++it->second;
+            ++samples_;
+        }
+
+        void SetFrame(int depth, const char* name) {
+            if (depth >= (int)frames_.size())
+                frames_.resize(depth + 1);
+
+            auto& frame = frames_[depth];
+            frame = name;
+            std::replace(frame.begin(), frame.end(), ';', ':');  // ';' is the frame separator
+        }
+
+    private:
+        ProfilerConfig config_;
+        bool running_ = false;
+        uint64_t last_us_ = 0;
+        uint64_t samples_ = 0;
+        std::string key_;
+        std::vector<std::string> frames_;
+        std::unordered_map<std::string, uint64_t> stacks_;
+    };
+
+    static void ProfilerHook(lua_State* l, lua_Debug* ar) {
+        State* s = GetState(l);
+        Profiler* profiler = s ? s->state_.profiler_ : nullptr;
+        if (profiler == nullptr || !profiler->IsRunning()) {
+            lua_sethook(l, nullptr, 0, 0);  // the coroutine created when profiling
+            return;
+        }
+        profiler->OnHook(l);
+    }
+
+    /* the coroutine created before the profiler started has no hook */
+    static void HookProfiler(State* s, lua_State* co) {
+        Profiler* profiler = s->state_.profiler_;
+        if (profiler && profiler->IsRunning() && lua_gethook(co) != &ProfilerHook)
+            lua_sethook(co, &ProfilerHook, LUA_MASKCOUNT, profiler->Count());
+    }
+
+    bool StartProfiler(State* s, const ProfilerConfig& config) {
+        if (config.count <= 0 || config.max_depth <= 0)
+            return false;
+
+        delete s->state_.profiler_;
+        s->state_.profiler_ = new Profiler(config);
+        s->state_.profiler_->SetRunning(true);
+
+        // the coroutines created later inherit the hook
+        lua_sethook(s->state_.main_, &ProfilerHook, LUA_MASKCOUNT, config.count);
+        if (s->state_.l_ != s->state_.main_)
+            lua_sethook(s->state_.l_, &ProfilerHook, LUA_MASKCOUNT, config.count);
+        return true;
+    }
+
+    void StopProfiler(State* s) {
+        if (s->state_.profiler_ == nullptr)
+            return;
+
+        s->state_.profiler_->SetRunning(false);
+        lua_sethook(s->state_.main_, nullptr, 0, 0);
+        if (s->state_.l_ != s->state_.main_)
+            lua_sethook(s->state_.l_, nullptr, 0, 0);
+    }
+
+    bool WriteProfile(const State* s, const char* file) {
+        return s->state_.profiler_ && s->state_.profiler_->Write(file);
+    }
+
+    uint64_t GetProfileSamples(const State* s) {
+        return s->state_.profiler_ ? s->state_.profiler_->Samples() : 0;
+    }
+
+    /* lua heap attribution, wrap the allocator of lua state
+     * every sample_bytes allocated is attributed to the current lua source line
+    */
+    class HeapProfiler {
+    public:
+        HeapProfiler(State* s, const HeapProfilerConfig& config) : state_(s), config_(config) {
+            countdown_ = (int64_t)config.sample_bytes;
+        }
+
+    public:
+        static void* LuaAlloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+            auto* profiler = static_cast<HeapProfiler*>(ud);
+            if (ptr == nullptr)
+                osize = 0;  // osize is the lua type of new object
+            if (profiler->running_ && nsize > osize)
+                profiler->OnAlloc(nsize - osize);
+            return profiler->alloc_(profiler->alloc_ud_, ptr, osize, nsize);
+        }
+
+        inline bool IsRunning() const { return running_; }
+
+        void Start() {
+            alloc_ = lua_getallocf(state_->state_.main_, &alloc_ud_);
+            lua_setallocf(state_->state_.main_, &LuaAlloc, this);
+            running_ = true;
+        }
+
+        /* the blocks allocated by the wrapper are released by the origin allocator */
+        void Stop() {
+            if (!running_)
+                return;
+            running_ = false;
+            lua_setallocf(state_->state_.main_, alloc_, alloc_ud_);
+        }
+
+        std::vector<AllocSite> GetSites() const {
+            std::vector<AllocSite> sites;
+            for (const auto& pair : sites_) {
+                sites.push_back(AllocSite());
+                sites.back().site = pair.first.c_str();
+                sites.back().samples = pair.second;
+                sites.back().bytes = pair.second * config_.sample_bytes;
+            }
+            std::sort(sites.begin(), sites.end(), [](const AllocSite& l, const AllocSite& r) {
+                return l.samples > r.samples;
+            });
+            return sites;
+        }
+
+    private:
+        void OnAlloc(size_t size) {
+            countdown_ -= (int64_t)size;
+            while (countdown_ <= 0) {
+                countdown_ += (int64_t)config_.sample_bytes;
+                Sample();
+            }
+        }
+
+        /* "Sl" does not allocate, it is safe to call in the allocator
+         * the coroutine resumed by lua is not tracked, the memory is attributed to the resume call
+        */
+        void Sample() {
+            lua_State* l = state_->state_.resuming_ ? state_->state_.resuming_ : state_->state_.main_;
+            lua_Debug dbg;
+            key_ = "[C]";
+            for (int level = 0; lua_getstack(l, level, &dbg); ++level) {
+                lua_getinfo(l, "Sl", &dbg);
+                if (dbg.currentline < 0)
+                    continue;
+
+                char buff[256];
+                snprintf(buff, sizeof(buff), "%s:%d", dbg.short_src, dbg.currentline);
+                key_ = buff;
+                break;
+            }
+
+            auto it = sites_.find(key_);
+            if (it == sites_.end()) {
+                if (sites_.size() >= config_.max_sites)
+                    key_ = "[other]";
+                it = sites_.insert(std::make_pair(key_, 0)).first;
+            }
+            ++it->second;
+        }
+
+    private:
+        State* state_;
+        HeapProfilerConfig config_;
+        lua_Alloc alloc_ = nullptr;
+        void* alloc_ud_ = nullptr;
+        bool running_ = false;
+        int64_t countdown_ = 0;
+        std::string key_;
+        std::unordered_map<std::string, uint64_t> sites_;
+    };
+
+    bool StartHeapProfiler(State* s, const HeapProfilerConfig& config) {
+        if (config.sample_bytes == 0)
+            return false;
+
+        if (s->state_.heap_profiler_) {
+            s->state_.heap_profiler_->Stop();
+            delete s->state_.heap_profiler_;
+        }
+
+        s->state_.heap_profiler_ = new HeapProfiler(s, config);
+        s->state_.heap_profiler_->Start();
+        s->state_.track_ud_ = true;
+        s->state_.ud_stats_.clear();
+        if (++s->state_.ud_session_ == 0)   // 0 is the userdata created out of session
+            s->state_.ud_session_ = 1;
+        return true;
+    }
+
+    void StopHeapProfiler(State* s) {
+        if (s->state_.heap_profiler_)
+            s->state_.heap_profiler_->Stop();
+        s->state_.track_ud_ = false;
+    }
+
+    std::vector<AllocSite> GetAllocSites(const State* s) {
+        if (s->state_.heap_profiler_ == nullptr)
+            return std::vector<AllocSite>();
+        return s->state_.heap_profiler_->GetSites();
+    }
+
+    std::vector<UdStat> GetUdStats(const State* s) {
+        std::vector<UdStat> stats;
+        for (const auto& pair : s->state_.ud_stats_)
+            stats.push_back(pair.second);
+
+        auto live = [](const UdStat& stat) {
+            int64_t count = 0;
+            for (int64_t c : stat.live)
+                count += c;
+            return count;
+        };
+        std::sort(stats.begin(), stats.end(), [&live](const UdStat& l, const UdStat& r) {
+            return live(l) > live(r);
+        });
+        return stats;
+    }
+
+    CacheStats GetCacheStats(const State* s) {
+        const auto& state = s->state_;
+        CacheStats stats;
+        stats.value_uds = (size_t)state.value_ud_ary_.Count();
+        stats.value_refs = state.value_ud_refs_.size();
+        stats.declared_ptr_uds = state.declared_ptr_uds_.size();
+        stats.collection_ptr_uds = state.collection_ptr_uds_.size();
+        stats.smart_ptr_uds = state.smart_ptr_uds_.size();
+        for (const auto& objs : state.weak_obj_caches_) {
+            stats.weak_obj_slots += objs.size();
+            for (const auto& cache : objs) {
+                if (cache.ud)
+                    ++stats.weak_obj_uds;
+            }
+        }
+        stats.gc_pending = state.gc_pending_.size();
+        return stats;
+    }
+
+    std::string DumpHeapProfile(const State* s) {
+        char buff[256];
+        std::string str;
+        snprintf(buff, sizeof(buff), "%-48s %10s %12s\n", "site", "samples", "bytes");
+        str = buff;
+        for (const auto& site : GetAllocSites(s)) {
+            snprintf(buff, sizeof(buff), "%-48s %10llu %12llu\n", site.site,
+                (unsigned long long)site.samples, (unsigned long long)site.bytes);
+            str += buff;
+        }
+
+        snprintf(buff, sizeof(buff), "\n%-32s %16s %16s %16s\n", "type", "ptr(live/new)", "smart(live/new)", "value(live/new)");
+        str += buff;
+        for (const auto& stat : GetUdStats(s)) {
+            snprintf(buff, sizeof(buff), "%-32s", stat.type);
+            str += buff;
+            for (int i = 0; i < UdStat::kKindNum; ++i) {
+                char count[64];
+                snprintf(count, sizeof(count), "%lld/%llu", (long long)stat.live[i], (unsigned long long)stat.created[i]);
+                snprintf(buff, sizeof(buff), " %16s", count);
+                str += buff;
+            }
+            str += "\n";
+        }
+        return str;
+    }
+
+    int InternKeyId(const char* str, size_t len) {
+        static std::mutex s_mutex;
+        static std::unordered_map<std::string, int> s_key_ids;
+        std::lock_guard<std::mutex> lock(s_mutex);
+        return s_key_ids.emplace(std::string(str, len), (int)s_key_ids.size()).first->second;
+    }
+
+    bool CheckParameters(State* s, int index, const CallDesc& desc) {
+        for (size_t i = 0; i < desc.param_num; ++i) {
+            if (!desc.params[i].check(s, index + (int)i))
+                return false;
+        }
+        return true;
+    }
+
+    char* GetParameterNames(char* buff, size_t len, State* s, int index, const CallDesc& desc) {
+        if (desc.param_num == 0) {
+            snprintf(buff, len, "none");
+            return buff;
+        }
+
+        size_t pos = 0;
+        buff[0] = 0;
+        for (size_t i = 0; i < desc.param_num && pos < len; ++i) {
+            int w = snprintf(buff + pos, len - pos, i ? ", [%d] %s(%s)" : "[%d] %s(%s)",
+                (int)(i + 1), desc.params[i].name(), s->GetTypeName(index + (int)i));
+            if (w < 0)
+                break;
+            pos += (size_t)w;
+        }
+        return buff;
+    }
+
+    void PushStruct(State* s, const StructDesc* desc, const void* obj) {
+        lua_State* l = s->GetLuaState();
+        luaL_checkstack(l, 3, nullptr);
+        lua_createtable(l, 0, desc->field_num);
+        for (int i = 0; i < desc->field_num; ++i) {
+            const StructField& field = desc->fields[i];
+            s->state_.PushKey(*field.key);
+            field.push(s, obj);
+            lua_rawset(l, -3);
+        }
+    }
+
+    /* rawget with the pinned key strings, the hash is calculated already,
+     * cheaper than a lua_next traversal that has to find the last key on each step
+    */
+    void LoadStruct(State* s, int index, const StructDesc* desc, void* obj) {
+        lua_State* l = s->GetLuaState();
+        index = lua_absindex(l, index);
+        luaL_checkstack(l, 2, nullptr);
+        for (int i = 0; i < desc->field_num; ++i) {
+            const StructField& field = desc->fields[i];
+            s->state_.PushKey(*field.key);
+            if (lua_rawget(l, index) != LUA_TNIL)
+                field.load(s, obj);
+            lua_pop(l, 1);
+        }
+    }
+
+    /* export member registered for call statistics */
+    struct CallStatSite {
+        const TypeDesc* desc;
+        std::string name;
+    };
+
+    static std::mutex g_call_stat_mutex;
+    static std::deque<CallStatSite> g_call_stat_sites;  // element address is stable
+
+    int RegisterCallStat(const TypeDesc* desc, StringView name, const char* op) {
+        std::lock_guard<std::mutex> lock(g_call_stat_mutex);
+        g_call_stat_sites.push_back(CallStatSite{desc, std::string(name.str, name.len) + op});
+        return (int)g_call_stat_sites.size() - 1;
+    }
+
+    std::vector<CallStat> GetCallStats(const State* s) {
+        std::vector<CallStat> stats;
+        std::lock_guard<std::mutex> lock(g_call_stat_mutex);
+        const auto& call_stats = s->state_.call_stats_;
+        for (size_t i = 0; i < call_stats.size(); ++i) {
+            if (call_stats[i].calls == 0)
+                continue;
+
+            const auto& site = g_call_stat_sites[i];
+            stats.push_back(call_stats[i]);
+            stats.back().type = site.desc ? site.desc->name : "";
+            stats.back().name = site.name.c_str();
+        }
+
+        // the most expensive first
+        std::sort(stats.begin(), stats.end(), [](const CallStat& l, const CallStat& r) {
+            return l.total_ns > r.total_ns;
+        });
+        return stats;
+    }
+
+    std::string DumpCallStats(const State* s, bool csv) {
+        char buff[256];
+        std::string str;
+        if (csv) {
+            str = "type,name,calls,failed,total_ns,max_ns";
+            for (int i = 0; i < CallStat::kHistNum; ++i) {
+                snprintf(buff, sizeof(buff), ",lt_%llu_ns", 1ull << (i + 7));
+                str += buff;
+            }
+            str += "\n";
+        } else {
+            snprintf(buff, sizeof(buff), "%-40s %10s %8s %12s %10s %10s\n",
+                "member", "calls", "failed", "total(us)", "avg(ns)", "max(ns)");
+            str = buff;
+        }
+
+        for (const auto& stat : GetCallStats(s)) {
+            if (csv) {
+                snprintf(buff, sizeof(buff), "%s,%s,%llu,%llu,%llu,%llu", stat.type, stat.name,
+                    (unsigned long long)stat.calls, (unsigned long long)stat.failed,
+                    (unsigned long long)stat.total_ns, (unsigned long long)stat.max_ns);
+                str += buff;
+                for (uint32_t count : stat.hist) {
+                    snprintf(buff, sizeof(buff), ",%u", count);
+                    str += buff;
+                }
+                str += "\n";
+            } else {
+                std::string name = std::string(stat.type) + "." + stat.name;
+                snprintf(buff, sizeof(buff), "%-40s %10llu %8llu %12llu %10llu %10llu\n", name.c_str(),
+                    (unsigned long long)stat.calls, (unsigned long long)stat.failed,
+                    (unsigned long long)(stat.total_ns / 1000), (unsigned long long)(stat.total_ns / stat.calls),
+                    (unsigned long long)stat.max_ns);
+                str += buff;
+            }
+        }
+        return str;
+    }
+
     void Destory(State* s) {
+        // the waiting async calls will never be resumed
+        auto& async_ary = s->state_.async_ary_;
+        for (int i = 1, c = async_ary.Size(); i < c; ++i) {
+            if (!async_ary.IsValid(i))
+                continue;
+
+            auto data = async_ary.GetValue(i);
+            if (s->state_.is_attach_)
+                luaL_unref(s->state_.main_, LUA_REGISTRYINDEX, async_ary.GetRef(i));
+            async_ary.Free(i);
+            data->state = nullptr;
+            data->co = nullptr;
+            data->index = 0;
+        }
+
+        s->state_.scheduler_.Clear(s->state_.is_attach_ ? s->state_.main_ : nullptr);
+
+        s->state_.CheckFlushGc();
+        if (s->state_.heap_profiler_)
+            s->state_.heap_profiler_->Stop();
+
+        if (s->state_.is_attach_) {
+            for (int ref : s->state_.key_refs_) {
+                if (ref != LUA_NOREF)
+                    luaL_unref(s->state_.main_, LUA_REGISTRYINDEX, ref);
+            }
+        }
+
+        /* the deferred payloads may hold lua refs, destroy them before the lua state closed */
+        s->state_.closing_ = true;
+        s->DrainDeferred();
+
         //TODO: how to detach state
         if (!s->state_.is_attach_)
-            lua_close(s->state_.l_);
+            lua_close(s->state_.main_);
+        s->state_.gc_pending_.clear();
+        delete s->state_.profiler_;
+        delete s->state_.heap_profiler_;
+        delete s->state_.alloc_;
 
         // remove from state list
-        auto it = std::find_if(g_env.state_list.begin(), g_env.state_list.end(),
-            [s](const std::pair<lua_State*, State*>& pair) {
-            return pair.second == s;
-        });
-        g_env.state_list.erase(it);
+        RemoveState(s);
 
         delete s;
     }
@@ -194,24 +1272,35 @@ namespace internal {
 
 #if XLUA_ENABLE_LUD_OPTIMIZE
     static const TypeDesc* GetWeakObjDesc(int weak_index, int obj_index) {
-        auto& caches = g_env.declared.lua_weak_data_list[weak_index];
-        if (caches.size() > obj_index)
-            return caches[obj_index].desc;
-        return nullptr;
+        auto* ary = g_env.declared.lua_weak_data_list[weak_index].load(std::memory_order_acquire);
+        auto* data = ary ? ary->Get(obj_index) : nullptr;
+        return data ? data->desc.load(std::memory_order_acquire) : nullptr;
     }
 
     static void SetWeakObjDesc(int weak_idnex, int obj_index, int obj_serial, const TypeDesc* desc) {
         assert(weak_idnex > 0 && weak_idnex <= kMaxLudIndex);
-        auto& caches = g_env.declared.lua_weak_data_list[weak_idnex];
-        if (obj_index >= (int)caches.size()) {
-            caches.resize(
-                (obj_index / XLUA_CONTAINER_INCREMENTAL + 1) * XLUA_CONTAINER_INCREMENTAL,
-                LudWeakData{nullptr, 0});
+        auto& list = g_env.declared.lua_weak_data_list[weak_idnex];
+        auto* ary = list.load(std::memory_order_acquire);
+        if (ary == nullptr) {
+            auto* fresh = new LudWeakArray();
+            if (list.compare_exchange_strong(ary, fresh, std::memory_order_acq_rel))
+                ary = fresh;
+            else
+                delete fresh;
+        }
+
+        auto* data = ary->Alloc(obj_index);
+        if (data->serial.load(std::memory_order_acquire) != obj_serial) {
+            data->desc.store(desc, std::memory_order_release);
+            data->serial.store(obj_serial, std::memory_order_release);
+            return;
         }
 
-        auto d = caches[obj_index];
-        if (d.serial != obj_serial || IsBaseOf(d.desc, desc))
-            caches[obj_index] = LudWeakData{desc, obj_serial};
+        // keep the most derived type of the object
+        const TypeDesc* cur = data->desc.load(std::memory_order_acquire);
+        while (cur != desc && IsBaseOf(cur, desc) &&
+            !data->desc.compare_exchange_weak(cur, desc, std::memory_order_acq_rel)) {
+        }
     }
 
     const TypeDesc* GetLightUdDesc(LightUd ld) {
@@ -298,14 +1387,16 @@ namespace meta {
         auto* indexer = (LuaIndexer)(lua_touserdata(l, 2));
         auto* state = (State*)(lua_touserdata(l, 3));
         auto* desc = (const TypeDesc*)(lua_touserdata(l, 4));
+        state->state_.l_ = l;   // may be called in coroutine
         return indexer(state, nullptr, desc);
     }
 
     static int __index_member(lua_State* l) {
         /* the bottom stack value is __newindex value */
-        auto* indexer = static_cast<LuaIndexer>(lua_touserdata(l, 2));
+        auto* indexer = (LuaIndexer)(lua_touserdata(l, 2));
         auto* state = static_cast<State*>(lua_touserdata(l, 3));
         auto* ud = static_cast<FullUd*>(lua_touserdata(l, 4));
+        state->state_.l_ = l;   // may be called in coroutine
 
         if (!ud->IsValid()) {
             //TODO: error
@@ -322,7 +1413,7 @@ namespace meta {
             return 0;
         }
 
-        return indexer(state, ud->ptr, ud->desc);
+        return indexer(state, obj, ud->desc);
     }
 
     static int __to_string_member(lua_State* l) {
@@ -371,6 +1462,7 @@ namespace meta {
         auto* ptr = lua_touserdata(l, 4);                       // obj
         auto* desc = (const TypeDesc*)(lua_touserdata(l, 5));   // type desc
         lua_settop(l, 1);                                       // pop all not uesed any alue
+        state->state_.l_ = l;                                   // may be called in coroutine
         return indexer(state, ptr, desc);
     }
 
@@ -573,7 +1665,7 @@ namespace utility {
 #endif // XLUA_ENABLE_LUD_OPTIMIZE
 
         auto* ud = static_cast<internal::FullUd*>(info.ud);
-        ud->desc = desc;
+        internal::GetState(l)->state_.SetUdDesc(ud, desc);
         if (info.desc->weak_index)
             ud->ref = desc->weak_proc.maker(derived);
         else
@@ -614,18 +1706,154 @@ namespace utility {
             info.collection->Clear(info.obj);
         return 0;
     }
+
+    /* collection operate, copy elements to a new lua table */
+    static int __to_table(lua_State* l) {
+        auto info = GetUdInfo(l, 1);
+        if (!info || info.major != internal::UdMajor::kCollection)
+            return luaL_error(l, "to table only could process collection object");
+        if (!info.collection->ToTable(info.obj, internal::GetState(l)))
+            return luaL_error(l, "collection [%s] not support to table", info.collection->Name());
+        return 1;
+    }
+
+    /* collection operate, replace elements by the lua table */
+    static int __from_table(lua_State* l) {
+        auto info = GetUdInfo(l, 1);
+        if (!info || info.major != internal::UdMajor::kCollection)
+            return luaL_error(l, "from table only could process collection object");
+        luaL_checktype(l, 2, LUA_TTABLE);
+        if (!info.collection->FromTable(info.obj, internal::GetState(l), 2))
+            return luaL_error(l, "collection [%s] not support from table", info.collection->Name());
+        return 0;
+    }
+
+    /* resume the coroutine by lua, as the auxresume of lcorolib
+     * the running thread of the state is switched to the coroutine and back
+    */
+    static int AuxResume(lua_State* l, lua_State* co, int narg) {
+        if (!lua_checkstack(co, narg)) {
+            lua_pushliteral(l, "too many arguments to resume");
+            return -1;
+        }
+        if (lua_status(co) == LUA_OK && lua_gettop(co) == 0) {
+            lua_pushliteral(l, "cannot resume dead coroutine");
+            return -1;
+        }
+
+        State* s = internal::GetState(l);
+        if (s) {
+            internal::HookProfiler(s, co);
+            s->state_.l_ = co;
+        }
+        lua_xmove(l, co, narg);
+        int status = lua_resume(co, l, narg);
+        if (s)
+            s->state_.l_ = l;
+
+        if (status == LUA_OK || status == LUA_YIELD) {
+            int nres = lua_gettop(co);
+            if (!lua_checkstack(l, nres + 1)) {
+                lua_pop(co, nres);
+                lua_pushliteral(l, "too many results to resume");
+                return -1;
+            }
+            lua_xmove(co, l, nres);
+            return nres;
+        }
+
+        lua_xmove(co, l, 1);    // error message
+        return -1;
+    }
+
+    /* coroutine.resume */
+    static int __co_resume(lua_State* l) {
+        lua_State* co = lua_tothread(l, 1);
+        luaL_argcheck(l, co, 1, "coroutine expected");
+        int r = AuxResume(l, co, lua_gettop(l) - 1);
+        if (r < 0) {
+            lua_pushboolean(l, 0);
+            lua_insert(l, -2);
+            return 2;
+        }
+
+        lua_pushboolean(l, 1);
+        lua_insert(l, -(r + 1));
+        return r + 1;
+    }
+
+    static int __co_auxwrap(lua_State* l) {
+        lua_State* co = lua_tothread(l, lua_upvalueindex(1));
+        int r = AuxResume(l, co, lua_gettop(l));
+        if (r < 0) {
+            if (lua_type(l, -1) == LUA_TSTRING) {   // add position information
+                luaL_where(l, 1);
+                lua_insert(l, -2);
+                lua_concat(l, 2);
+            }
+            return lua_error(l);
+        }
+        return r;
+    }
+
+    /* coroutine.wrap */
+    static int __co_wrap(lua_State* l) {
+        luaL_checktype(l, 1, LUA_TFUNCTION);
+        lua_State* co = lua_newthread(l);
+        lua_pushvalue(l, 1);
+        lua_xmove(l, co, 1);
+        lua_pushcclosure(l, &__co_auxwrap, 1);
+        return 1;
+    }
+
+    /* coroutine wait milliseconds */
+    static int __wait(lua_State* l) {
+        lua_Integer ms = luaL_checkinteger(l, 1);
+        if (!lua_isyieldable(l))
+            return luaL_error(l, "attempt to wait outside a coroutine");
+
+        internal::GetState(l)->state_.scheduler_.WaitTime(l, ms);
+        return lua_yield(l, 0);
+    }
+
+    /* coroutine wait frames(ticks) */
+    static int __wait_frames(lua_State* l) {
+        lua_Integer frames = luaL_checkinteger(l, 1);
+        if (!lua_isyieldable(l))
+            return luaL_error(l, "attempt to wait outside a coroutine");
+
+        internal::GetState(l)->state_.scheduler_.WaitFrames(l, frames);
+        return lua_yield(l, 0);
+    }
+
+    /* coroutine wait signal */
+    static int __wait_signal(lua_State* l) {
+        lua_Integer id = luaL_checkinteger(l, 1);
+        if (!lua_isyieldable(l))
+            return luaL_error(l, "attempt to wait outside a coroutine");
+
+        internal::GetState(l)->state_.scheduler_.WaitSignal(l, id);
+        return lua_yield(l, 0);
+    }
+
+    /* wake up the coroutines waiting for the signal at next tick */
+    static int __signal(lua_State* l) {
+        lua_Integer id = luaL_checkinteger(l, 1);
+        internal::GetState(l)->state_.scheduler_.Signal(id);
+        return 0;
+    }
 }
 
 namespace internal {
     static size_t GetVarNum(const TypeData& td, bool global) {
-        size_t n = (global ? td.global_vars : td.member_vars).len;
+        size_t n = td.var_num[global ? 1 : 0];
         if (td.super)
             return n + GetVarNum(*static_cast<const TypeData*>(td.super), global);
         return n;
     }
 
     static size_t GetFuncNum(const TypeData& td, bool global) {
-        size_t n = (global ? td.global_funcs : td.member_funcs).len;
+        size_t n = td.func_num[global ? 1 : 0];
         if (td.super)
             return n + GetFuncNum(*static_cast<const TypeData*>(td.super), global);
         return n;
@@ -633,14 +1861,11 @@ namespace internal {
 
     /* append export node to list tail */
     void AppendNode(ExportNode* node) {
-        if (g_node_head == nullptr) {
+        if (g_node_head == nullptr)
             g_node_head = node;
-        } else {
-            auto* tail = g_node_head;
-            while (tail->next)
-                tail = tail->next;
-            tail->next = node;
-        }
+        else
+            g_node_tail->next = node;
+        g_node_tail = node;
     }
 
     /* xlua weak obj reference support */
@@ -649,30 +1874,27 @@ namespace internal {
 
         // already cached the object
         if (index.index_)
-            return WeakObjRef{index.index_, ary.objs[index.index_].serial};
-
-        // alloc obj slots
-        if (ary.empty_slot == 0) {
-            size_t sz = ary.objs.size();
-            size_t ns = sz + XLUA_CONTAINER_INCREMENTAL;
-            ary.objs.resize(ns);
-            for (size_t i = ns; i > sz; --i) {
-                auto& slot = ary.objs[i-1];
-                slot.serial = 0;
-                slot.next = (int)i;
-            }
-            ary.objs[ns - 1].next = 0;
-            ary.empty_slot = (int)sz;
-        }
+            return WeakObjRef{index.index_, ary.objs.Get(index.index_)->serial.load(std::memory_order_acquire)};
 
+        std::lock_guard<std::mutex> lock(ary.mutex);
         int idx = ary.empty_slot;
-        auto& obj = ary.objs[idx];
-        ary.empty_slot = obj.next;
-        index.index_ = idx;
+        WeakObjSlot* obj = nullptr;
+        if (idx) {
+            obj = ary.objs.Get(idx);
+            ary.empty_slot = obj->next;
+        } else {
+            obj = ary.objs.Alloc(ary.size);
+            if (obj == nullptr)
+                return WeakObjRef{0, 0};    // out of slots
+            idx = ary.size++;
+        }
 
-        obj.ptr = ptr;
-        obj.serial = ++ary.serial_gener;
-        return WeakObjRef{idx, obj.serial};
+        // the ptr is published before the serial, the readers check the serial around the ptr
+        int serial = ++ary.serial_gener;
+        obj->ptr.store(ptr, std::memory_order_release);
+        obj->serial.store(serial, std::memory_order_release);
+        index.index_ = idx;
+        return WeakObjRef{idx, serial};
     }
 
     /* free xlua object index */
@@ -681,25 +1903,27 @@ namespace internal {
             return;
 
         auto& ary = g_env.weak_obj_ary;
-        assert(index.index_ < (int)ary.objs.size());
-        if (index.index_ >= (int)ary.objs.size())
+        std::lock_guard<std::mutex> lock(ary.mutex);
+        auto* obj = ary.objs.Get(index.index_);
+        assert(obj);
+        if (obj == nullptr)
             return;
 
-        auto& ob = ary.objs[index.index_];
-        ob.serial = 0;
-        ob.next = ary.empty_slot;
+        obj->serial.store(0, std::memory_order_release);
+        obj->next = ary.empty_slot;
         ary.empty_slot = index.index_;
 
         index.index_ = 0;
     }
 
     void* GetWeakObjPtr(WeakObjRef ref) {
-        auto& ary = g_env.weak_obj_ary;
-        if (ref.index <= 0 && (int)ary.objs.size() <= ref.index)
+        auto* obj = ref.index > 0 ? g_env.weak_obj_ary.objs.Get(ref.index) : nullptr;
+        if (obj == nullptr || obj->serial.load(std::memory_order_acquire) != ref.serial)
             return nullptr;
 
-        auto& obj = ary.objs[ref.index];
-        return obj.serial == ref.serial ? obj.ptr : nullptr;
+        // the slot may be reused by other thread meanwhile
+        void* ptr = obj->ptr.load(std::memory_order_acquire);
+        return obj->serial.load(std::memory_order_acquire) == ref.serial ? ptr : nullptr;
     }
 
     static size_t PurifyTypeName(char* buf, size_t sz, const char* name) {
@@ -729,7 +1953,7 @@ namespace internal {
             else
                 snprintf(buf, kBuffCacheSize, "%s.%s", s->state_.module_, path);
         } else {
-            strcpy_s(buf, kBuffCacheSize, path);
+            snprintf(buf, kBuffCacheSize, "%s", path);
         }
 
         if (s->state_.LoadGlobal(buf) != LUA_TTABLE) {
@@ -822,6 +2046,27 @@ namespace internal {
         lua_setfield(s->GetLuaState(), -2, "Remove");
         lua_pushcfunction(s->GetLuaState(), &utility::__clear);
         lua_setfield(s->GetLuaState(), -2, "Clear");
+        lua_pushcfunction(s->GetLuaState(), &utility::__to_table);
+        lua_setfield(s->GetLuaState(), -2, "ToTable");
+        lua_pushcfunction(s->GetLuaState(), &utility::__from_table);
+        lua_setfield(s->GetLuaState(), -2, "FromTable");
+        lua_pushcfunction(s->GetLuaState(), &utility::__wait);
+        lua_setfield(s->GetLuaState(), -2, "Wait");
+        lua_pushcfunction(s->GetLuaState(), &utility::__wait_frames);
+        lua_setfield(s->GetLuaState(), -2, "WaitFrames");
+        lua_pushcfunction(s->GetLuaState(), &utility::__wait_signal);
+        lua_setfield(s->GetLuaState(), -2, "WaitSignal");
+        lua_pushcfunction(s->GetLuaState(), &utility::__signal);
+        lua_setfield(s->GetLuaState(), -2, "Signal");
+        lua_pop(s->GetLuaState(), 1);
+
+        // the running thread of the state is switched when lua resumes a coroutine
+        if (lua_getglobal(s->GetLuaState(), "coroutine") == LUA_TTABLE) {
+            lua_pushcfunction(s->GetLuaState(), &utility::__co_resume);
+            lua_setfield(s->GetLuaState(), -2, "resume");
+            lua_pushcfunction(s->GetLuaState(), &utility::__co_wrap);
+            lua_setfield(s->GetLuaState(), -2, "wrap");
+        }
         lua_pop(s->GetLuaState(), 1);
 
         assert(s->GetTop() == 0);
@@ -875,10 +2120,12 @@ namespace internal {
         if (td.super)
             PushFuncs(l, *static_cast<const TypeData*>(td.super), global);
 
-        const auto& funcs = global ? td.global_funcs : td.member_funcs;
-        for (size_t i = 0; i < funcs.len; ++i) {
-            lua_pushcfunction(l, funcs.data[i].func);
-            lua_setfield(l, -2, funcs.data[i].name);
+        for (const auto* m = td.members; m->kind != ExportMember::Kind::kNone; ++m) {
+            if (m->kind != ExportMember::Kind::kFunc || IsGlobal(td, *m) != global)
+                continue;
+            lua_pushlstring(l, m->name, m->len);
+            lua_pushcfunction(l, m->func);
+            lua_settable(l, -3);
         }
     }
 
@@ -886,21 +2133,23 @@ namespace internal {
         if (td.super)
             PushVars(l, *static_cast<const TypeData*>(td.super), global);
 
-        const auto& vars = global ? td.global_vars : td.member_vars;
-        for (size_t i = 0; i < vars.len; ++i) {
-            const auto& v = vars.data[i];
+        for (const auto* m = td.members; m->kind != ExportMember::Kind::kNone; ++m) {
+            if (m->kind != ExportMember::Kind::kVar || IsGlobal(td, *m) != global)
+                continue;
+            const auto& v = *m;
+            lua_pushlstring(l, v.name, v.len);
             lua_createtable(l, 2, 0);
             if (v.getter)
-                lua_pushlightuserdata(l, static_cast<void*>(v.getter));
+                lua_pushlightuserdata(l, reinterpret_cast<void*>(v.getter));
             else
                 lua_pushnil(l);
             lua_seti(l, -2, 1);
             if (v.setter)
-                lua_pushlightuserdata(l, static_cast<void*>(v.setter));
+                lua_pushlightuserdata(l, reinterpret_cast<void*>(v.setter));
             else
                 lua_pushnil(l);
             lua_seti(l, -2, 2);
-            lua_setfield(l, -2, v.name);
+            lua_settable(l, -3);
         }
     }
 
@@ -979,7 +2228,21 @@ namespace internal {
         return true;
     }
 
-    static void Reg(State* s) {
+    /* same as the default panic of luaL_newstate */
+    static int Panic(lua_State* l) {
+        printf("PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(l, -1));
+        return 0;
+    }
+
+    static inline uint64_t ElapsedUs(std::chrono::steady_clock::time_point& last) {
+        auto now = std::chrono::steady_clock::now();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - last).count();
+        last = now;
+        return (uint64_t)us;
+    }
+
+    static void Reg(State* s, std::chrono::steady_clock::time_point& last) {
+        auto& stats = s->state_.startup_;
         auto* node = g_node_head;
         // reg const value and reg type
         while (node) {
@@ -989,6 +2252,7 @@ namespace internal {
                 static_cast<TypeNode*>(node)->reg();
             node = node->next;
         }
+        stats.reg_us = ElapsedUs(last);
 
         // reg liternal script
         node = g_node_head;
@@ -997,41 +2261,60 @@ namespace internal {
                 RegScript(s, static_cast<ScriptNode*>(node));
             node = node->next;
         }
+        stats.script_us = ElapsedUs(last);
 
         // reg declared type
         for (size_t i = 1, c = g_env.declared.desc_list.size(); i < c; ++i) {
             RegDeclared(s, *g_env.declared.desc_list[i]);
         }
+        stats.declared_us = ElapsedUs(last);
+        stats.declared = g_env.declared.desc_list.size() - 1;
         assert(s->GetTop() == 0);
     }
 } // namespace internal
 
-State* Create(const char* mod) {
-    lua_State* l = luaL_newstate();
+State* Create(const char* mod, bool pool_alloc) {
+    auto last = std::chrono::steady_clock::now();
+    State* s = new State();
+    internal::PoolAlloc* alloc = nullptr;
+    lua_State* l = nullptr;
+    if (pool_alloc) {
+        alloc = new internal::PoolAlloc(&s->state_.budget_);
+        l = lua_newstate(&internal::PoolAlloc::LuaAlloc, alloc);
+        lua_atpanic(l, &internal::Panic);
+    } else {
+        l = luaL_newstate();
+    }
     luaL_openlibs(l);
 
-    State* s = new State();
     s->state_.l_ = l;
+    s->state_.main_ = l;
+    s->state_.alloc_ = alloc;
     s->state_.is_attach_ = false;
     s->state_.module_ = mod;
 
     internal::InitState(s);
-    internal::Reg(s);
-    internal::g_env.state_list.push_back(std::make_pair(l, s));
+    s->state_.startup_.init_us = internal::ElapsedUs(last);
+    internal::Reg(s, last);
+    internal::AddState(l, s);
 
     assert(s->GetTop() == 0);
     return s;
 }
 
 State* Attach(lua_State* l, const char* mod) {
+    auto last = std::chrono::steady_clock::now();
     State* s = new State();
     s->state_.l_ = l;
+    s->state_.main_ = l;
+    s->state_.alloc_ = nullptr;
     s->state_.is_attach_ = true;
     s->state_.module_ = mod;
 
     internal::InitState(s);
-    internal::Reg(s);
-    internal::g_env.state_list.push_back(std::make_pair(l, s));
+    s->state_.startup_.init_us = internal::ElapsedUs(last);
+    internal::Reg(s, last);
+    internal::AddState(l, s);
 
     assert(s->GetTop() == 0);
     return s;
@@ -1055,34 +2338,35 @@ namespace internal {
         }
 
         void AddMember(bool global, const char* name, LuaFunction func) override {
-            name = AllocMemberName(name);
-            assert(CheckRename(name, is_global || global));
-            ((is_global || global) ? global_funcs : member_funcs).push_back(ExportFunc{name, func});
+            auto* str = AllocMemberName(name);
+            members.push_back(ExportMember{ExportMember::Kind::kFunc, global, str, ::strlen(str), func, nullptr, nullptr});
         }
 
         void AddMember(bool global, const char* name, LuaIndexer getter, LuaIndexer setter) override {
-            name = AllocMemberName(name);
-            assert(!Is_G(type_name));                       // _G table not allow variate
-            assert(CheckRename(name, is_global || global)); // rename check
-            ((is_global || global) ? global_vars : member_vars).push_back(ExportVar{name, getter, setter});
+            auto* str = AllocMemberName(name);
+            members.push_back(ExportMember{ExportMember::Kind::kVar, global, str, ::strlen(str), nullptr, getter, setter});
         }
 
-        bool CheckRename(const char* name, bool global) const {
-            auto& vars = (global ? global_vars : member_vars);
-            for (const auto& v : vars) {
-                if (::strcmp(v.name, name) == 0)
-                    return false;
-            }
+        /* copy the collected members to the arena, the table lives as long as the type */
+        const TypeDesc* Finalize() override {
+            size_t sz = (members.size() + 1) * sizeof(ExportMember);
+            auto* table = (ExportMember*)g_env.allocator.Alloc(sz);
+            if (!members.empty())
+                ::memcpy(table, &members[0], members.size() * sizeof(ExportMember));
+            table[members.size()] = ExportMember{};
+            return Finalize(table);
+        }
 
-            auto& funcs = (global ? global_funcs : member_funcs);
-            for (const auto& f : funcs) {
-                if (::strcmp(f.name, name) == 0)
+        bool CheckRename(const ExportMember* table, const ExportMember& member) const {
+            for (const auto* m = table; m != &member; ++m) {
+                if ((is_global || m->global) == (is_global || member.global) &&
+                    m->len == member.len && ::memcmp(m->name, member.name, m->len) == 0)
                     return false;
             }
             return true;
         }
 
-        const TypeDesc* Finalize() override {
+        const TypeDesc* Finalize(const ExportMember* table) override {
             std::unique_ptr<TypeCreator> hold(this);
             TypeData* data = g_env.allocator.AllocObj<TypeData>();
 
@@ -1125,13 +2409,28 @@ namespace internal {
 #endif // XLUA_ENABLE_MULTIPLE_INHERITANCE_OPTIMIZE
             }
 
-            data->member_vars = Alloc(member_vars);
-            data->global_vars = Alloc(global_vars);
-            data->member_funcs = Alloc(member_funcs);
-            data->global_funcs = Alloc(global_funcs);
+            data->members = table;
+            data->is_global = is_global;
+            data->var_num[0] = data->var_num[1] = 0;
+            data->func_num[0] = data->func_num[1] = 0;
+            for (const auto* m = table; m->kind != ExportMember::Kind::kNone; ++m) {
+                assert(CheckRename(table, *m));     // rename check
+                size_t global = (is_global || m->global) ? 1 : 0;
+                if (m->kind == ExportMember::Kind::kVar) {
+                    assert(!Is_G(type_name));       // _G table not allow variate
+                    ++data->var_num[global];
+                } else {
+                    ++data->func_num[global];
+                }
+            }
 
             // register to exist state
-            for (auto pair : g_env.state_list)
+            std::vector<std::pair<lua_State*, State*>> states;
+            {
+                std::lock_guard<std::mutex> lock(g_env.mutex);
+                states = g_env.state_list;
+            }
+            for (auto pair : states)
                 RegDeclared(pair.second, *data);
             return data;
         }
@@ -1154,26 +2453,6 @@ namespace internal {
             return buf;
         }
 
-        TypeVar Alloc(const std::vector<ExportVar>& vars) {
-            if (vars.empty())
-                return TypeVar{0, nullptr};
-
-            size_t sz = vars.size() * sizeof(ExportVar);
-            void* p = g_env.allocator.Alloc(sz);
-            ::memcpy(p, &vars[0], sz);
-            return TypeVar{vars.size(), (ExportVar*)p};
-        }
-
-        TypeFunc Alloc(const std::vector<ExportFunc>& funcs) {
-            if (funcs.empty())
-                return TypeFunc{0, nullptr};
-
-            size_t sz = funcs.size() * sizeof(ExportFunc);
-            void* p = g_env.allocator.Alloc(sz);
-            ::memcpy(p, &funcs[0], sz);
-            return TypeFunc{funcs.size(), (ExportFunc*)p};
-        }
-
         int GetWeakIndex() const {
             if (is_global || weak_proc.tag == 0)
                 return 0;
@@ -1231,10 +2510,7 @@ namespace internal {
         const TypeDesc* super = nullptr;
         TypeCaster caster{false, 0, 0, &DummyCaster};
         WeakObjProc weak_proc{0, nullptr, nullptr};
-        std::vector<ExportVar> member_vars;
-        std::vector<ExportVar> global_vars;
-        std::vector<ExportFunc> member_funcs;
-        std::vector<ExportFunc> global_funcs;
+        std::vector<ExportMember> members;    // collected by AddMember
     };
 
     ITypeFactory* CreateFactory(bool global, const char* path, const TypeDesc* super) {
@@ -5,8 +5,18 @@
 #include <list>
 #include <map>
 #include <unordered_map>
+#include <set>
+#include <unordered_set>
+#include <memory>
+#include <string>
+#include <limits>
+#include <algorithm>
 #include <assert.h>
+#include <string.h>
 #include <lua.hpp>
+#if XLUA_ENABLE_CALL_STATS
+#include <chrono>
+#endif // XLUA_ENABLE_CALL_STATS
 
 XLUA_NAMESPACE_BEGIN
 
@@ -46,6 +56,7 @@ namespace internal {
             int8_t tag_2_ = _XLUA_TAG_2;
             UdMajor major = UdMajor::kNone; // major userdata type
             UdMinor minor = UdMinor::kNone; // minor userdata type
+            uint8_t session = 0;            // ud count session created it, 0 is not counted
         };
         // data information
         union {
@@ -137,7 +148,7 @@ namespace internal {
             ptr = ud->desc->weak_proc.getter(ud->ref);
         else
             ptr = ud->ptr;
-        return _XLUA_TO_SUPER_PTR(ud->ptr, ud->desc, desc);
+        return _XLUA_TO_SUPER_PTR(ptr, ud->desc, desc);
     }
 
     inline void* As(FullUd* ud, ICollection* desc) {
@@ -149,8 +160,32 @@ namespace internal {
     /* object userdata, this ud will destruction on gc */
     struct IObjData {
         virtual ~IObjData() { }
+        /* move the payload out for deferred destruction, null if not support */
+        virtual IObjData* Detach(bool all) { return nullptr; }
     };
 
+    /* payload moved out of the gc userdata, destroy later */
+    template <typename Ty>
+    struct DeferData : IObjData {
+        DeferData(Ty&& o) : obj(std::move(o)) {}
+        virtual ~DeferData() {}
+
+        Ty obj;
+    };
+
+    template <typename Ty>
+    inline IObjData* DoDeferMove(Ty& obj, std::true_type) { return new DeferData<Ty>(std::move(obj)); }
+    template <typename Ty>
+    inline IObjData* DoDeferMove(Ty& obj, std::false_type) { return nullptr; }
+
+    /* only the type can be moved without throw */
+    template <typename Ty>
+    inline IObjData* DeferMove(Ty& obj, bool defer) {
+        if (!defer)
+            return nullptr;
+        return DoDeferMove(obj, std::integral_constant<bool, std::is_nothrow_move_constructible<Ty>::value>());
+    }
+
     template <typename Ty>
     struct AloneData : IObjData {
         template <typename... Args>
@@ -172,6 +207,10 @@ namespace internal {
         ValueDataImpl(Ty&& o) : obj(std::move(o)) {}
         virtual ~ValueDataImpl() {}
 
+        IObjData* Detach(bool all) override {
+            return DeferMove(obj, all || DeferDestruct<Ty>::value);
+        }
+
         Ty obj;
     };
 
@@ -199,6 +238,11 @@ namespace internal {
 
         virtual ~SmartPtrDataImpl() { }
 
+        IObjData* Detach(bool all) override {
+            return DeferMove(val, all || DeferDestruct<Sy>::value ||
+                DeferDestruct<typename std::pointer_traits<Sy>::element_type>::value);
+        }
+
         Sy val;
     };
 
@@ -435,11 +479,93 @@ namespace internal {
         return StringView(name, len);
     }
 
+    /* memory budget of state
+     * shared by the lua allocator and the xlua containers, the containers are
+     * charged but never refused, the lua allocation fails when over budget.
+     * the lua allocation is refused only in protected call, otherwise lua panics
+    */
+    struct MemBudget {
+        size_t limit = 0;   // 0 is unlimited
+        size_t xlua = 0;    // bytes used by xlua containers
+        int protect = 0;    // depth of the protected calls run by xlua
+    };
+
+    /* lift the quota while xlua creates a lua object and records it in its own caches,
+     * a refused allocation would longjmp out between the two steps and break the caches.
+     * the destructor is skipped by longjmp, so the call entries restore the depth too
+    */
+    struct QuotaLift {
+        QuotaLift(MemBudget* b) : budget(b), protect(b->protect) { b->protect = 0; }
+        ~QuotaLift() { budget->protect = protect; }
+
+        MemBudget* budget;
+        int protect;
+    };
+
+    /* stl allocator charge the memory to state budget */
+    template <typename Ty>
+    struct BudgetAllocator {
+        typedef Ty value_type;
+
+        BudgetAllocator() = default;
+        BudgetAllocator(MemBudget* b) : budget(b) {}
+        template <typename Uy>
+        BudgetAllocator(const BudgetAllocator<Uy>& other) : budget(other.budget) {}
+
+        inline Ty* allocate(size_t n) {
+            if (budget)
+                budget->xlua += n * sizeof(Ty);
+            return static_cast<Ty*>(::operator new(n * sizeof(Ty)));
+        }
+
+        inline void deallocate(Ty* p, size_t n) {
+            if (budget)
+                budget->xlua -= n * sizeof(Ty);
+            ::operator delete(p);
+        }
+
+        template <typename Uy>
+        inline bool operator == (const BudgetAllocator<Uy>& other) const { return budget == other.budget; }
+        template <typename Uy>
+        inline bool operator != (const BudgetAllocator<Uy>& other) const { return budget != other.budget; }
+
+        MemBudget* budget = nullptr;
+    };
+
+    template <typename Ky, typename Vy>
+    struct BudgetMap : std::unordered_map<Ky, Vy, std::hash<Ky>, std::equal_to<Ky>, BudgetAllocator<std::pair<const Ky, Vy>>> {
+        typedef std::unordered_map<Ky, Vy, std::hash<Ky>, std::equal_to<Ky>, BudgetAllocator<std::pair<const Ky, Vy>>> base_type;
+        BudgetMap(MemBudget* budget)
+            : base_type(0, std::hash<Ky>(), std::equal_to<Ky>(), BudgetAllocator<std::pair<const Ky, Vy>>(budget)) {}
+    };
+
+    template <typename Ty>
+    using BudgetVector = std::vector<Ty, BudgetAllocator<Ty>>;
+
     struct UdCache {
         int ref;    // lua reference index
         FullUd* ud; // lua userdata
     };
 
+    /* collected userdata whose cache is not released yet */
+    struct GcPending {
+        enum class Kind : int8_t {
+            kRef,               // only the cache ref
+            kCollectionPtr,
+            kDeclaredPtr,
+            kWeakObj,
+            kSmartPtr,
+            kValueRef,
+        };
+
+        Kind kind;
+        int ref;                // cache ref of kRef
+        int weak_index;
+        int obj_index;
+        void* key;              // cache map key
+        FullUd* ud;             // only for identify, the memory may be released
+    };
+
     template <typename Ty>
     class LuaObjRefArray {
         struct ObjRef {
@@ -451,7 +577,8 @@ namespace internal {
         };
 
     public:
-        LuaObjRefArray(Ty invalid) : invalid_(invalid_) {
+        LuaObjRefArray(Ty invalid, MemBudget* budget = nullptr)
+            : invalid_(invalid), objs_(BudgetAllocator<ObjRef>(budget)) {
             ObjRef o;
             o.next = 0;
             o.value = invalid_;
@@ -468,6 +595,15 @@ namespace internal {
             return false;
         }
 
+        inline int Size() const {
+            return (int)objs_.size();
+        }
+
+        /* allocated slot count */
+        inline int Count() const {
+            return count_;
+        }
+
         inline int GetRef(int index) const {
             return objs_[index].ref;
         }
@@ -499,6 +635,7 @@ namespace internal {
 
             obj.ref = ref;
             obj.value = val;
+            ++count_;
             return index;
         }
 
@@ -507,6 +644,7 @@ namespace internal {
             obj.next = Next();
             obj.value = invalid_;
             Next() = index;
+            --count_;
         }
 
     private:
@@ -516,9 +654,197 @@ namespace internal {
 
     private:
         const Ty invalid_;
-        std::vector<ObjRef> objs_;
+        int count_ = 0;
+        BudgetVector<ObjRef> objs_;
+    };
+
+    /* async call data
+     * shared by the exported function result and the coroutine waiting for it
+    */
+    struct AsyncData {
+        virtual ~AsyncData() {}
+        virtual void PushValue(State* s) = 0;
+
+        State* state = nullptr;     // waiting state
+        lua_State* co = nullptr;    // waiting coroutine
+        int index = 0;              // waiting slot index
+        bool ready = false;         // result is set
+        bool ok = true;             // false if the call is rejected
+        std::string error;          // reject message
+    };
+
+    void WaitAsync(State* s, const std::shared_ptr<AsyncData>& data);
+    /* release the slot of the coroutine waiting for async result */
+    void CancelAsync(State* s, lua_State* co);
+    /* write the error log by the log function of the state */
+    void Log(State* s, const char* fmt, ...);
+    void ResumeAsync(AsyncData* data);
+
+    /* intrusive double linked list node */
+    struct ListNode {
+        ListNode() : prev(this), next(this) {}
+        ListNode(const ListNode&) = delete;
+        void operator = (const ListNode&) = delete;
+
+        inline bool Empty() const { return next == this; }
+
+        inline void PushBack(ListNode* node) {
+            node->prev = prev;
+            node->next = this;
+            prev->next = node;
+            prev = node;
+        }
+
+        inline ListNode* PopFront() {
+            ListNode* node = next;
+            node->Unlink();
+            return node;
+        }
+
+        inline void Unlink() {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = this;
+        }
+
+        /* move all nodes of other list to the back */
+        inline void Splice(ListNode* other) {
+            if (other->Empty())
+                return;
+            other->next->prev = prev;
+            prev->next = other->next;
+            other->prev->next = this;
+            prev = other->prev;
+            other->prev = other->next = other;
+        }
+
+        ListNode* prev;
+        ListNode* next;
+    };
+
+    /* coroutine waiting for scheduler */
+    struct WaitNode : ListNode {
+        lua_State* co = nullptr;    // waiting coroutine
+        int ref = LUA_NOREF;        // coroutine registry reference
+        uint64_t expire = 0;        // expire time or frame
+    };
+
+    /* hierarchical timer wheel */
+    class TimerWheel {
+    public:
+        static constexpr int kSlotBits = 8;
+        static constexpr int kSlotNum = 1 << kSlotBits;
+        static constexpr int kLevelNum = 4;
+
+    public:
+        inline uint64_t Now() const { return now_; }
+        inline size_t Count() const { return count_; }
+
+        /* the node expired not later than now is due at next advance */
+        void Add(WaitNode* node, uint64_t expire);
+        /* move the expired nodes to the ready list */
+        void Advance(uint64_t now, ListNode* ready);
+        void Clear(ListNode* out);
+
+    private:
+        void Insert(WaitNode* node);
+
+    private:
+        uint64_t now_ = 0;
+        size_t count_ = 0;
+        ListNode slots_[kLevelNum][kSlotNum];
     };
 
+    /* coroutine scheduler
+     * wait time(ms), frames or signal, the due coroutines are resumed by tick
+    */
+    class Scheduler {
+    public:
+        Scheduler() = default;
+        ~Scheduler();
+        Scheduler(const Scheduler&) = delete;
+        void operator = (const Scheduler&) = delete;
+
+    public:
+        void WaitTime(lua_State* co, int64_t ms);
+        void WaitFrames(lua_State* co, int64_t frames);
+        void WaitSignal(lua_State* co, int64_t id);
+        void Signal(int64_t id);
+        /* collect the due coroutines to the ready list */
+        void Update(uint64_t now, ListNode* ready);
+        void FreeNode(WaitNode* node);
+        /* release all waiting coroutines */
+        void Clear(lua_State* l);
+
+        inline size_t Count() const { return count_; }
+
+    private:
+        WaitNode* AllocNode(lua_State* co);
+
+    private:
+        bool started_ = false;
+        uint64_t base_time_ = 0;
+        size_t count_ = 0;
+        TimerWheel timers_;
+        TimerWheel frames_;
+        ListNode ready_;
+        ListNode free_;
+        std::unordered_map<int64_t, ListNode> signals_;
+    };
+
+    void TickScheduler(State* s, uint64_t now);
+
+    /* frame budgeted gc controller */
+    struct GcControl {
+        static constexpr size_t kMinStepKb = 4;
+        static constexpr size_t kMaxStepKb = 64;   // sweep and finalizers cost far more per KB than marking
+
+        bool auto_gc = true;        // lua incremental collector is running
+        int pause = 200;            // same as LUAI_GCPAUSE
+        size_t last_bytes = 0;      // heap size at the end of last step
+        size_t threshold = 0;       // heap size to start next cycle
+        uint64_t ns_per_kb = 0;     // measured cost of 1KB gc step
+        uint64_t cycle_slice_us = 0;    // max slice of current cycle
+        GcStats stats;
+    };
+
+    /* run gc slices until the budget is used, return true if a gc cycle finished */
+    bool GcStep(State* s, uint64_t budget_us);
+    void SetGcAuto(State* s, bool enable);
+
+    /* size-class pool allocator, implement in core.cpp */
+    class PoolAlloc;
+    AllocStats GetAllocStats(const PoolAlloc* alloc, const MemBudget& budget);
+
+    /* sampling lua profiler, implement in core.cpp */
+    class Profiler;
+    bool StartProfiler(State* s, const ProfilerConfig& config);
+    void StopProfiler(State* s);
+    /* write the folded stacks (flamegraph format) */
+    bool WriteProfile(const State* s, const char* file);
+    uint64_t GetProfileSamples(const State* s);
+
+    /* lua heap attribution, implement in core.cpp */
+    class HeapProfiler;
+    bool StartHeapProfiler(State* s, const HeapProfilerConfig& config);
+    void StopHeapProfiler(State* s);
+    std::vector<AllocSite> GetAllocSites(const State* s);
+    std::vector<UdStat> GetUdStats(const State* s);
+    std::string DumpHeapProfile(const State* s);
+    CacheStats GetCacheStats(const State* s);
+
+    /* export member call statistics */
+    struct CallMark {
+        int id;             // statistics index
+        int prev;           // outer call
+        uint64_t begin;     // begin time(ns)
+    };
+
+    /* op: name suffix, as ".get", ".set" of variate */
+    int RegisterCallStat(const TypeDesc* desc, StringView name, const char* op);
+    std::vector<CallStat> GetCallStats(const State* s);
+    std::string DumpCallStats(const State* s, bool csv);
+
     /* check the path whether is G table */
     inline constexpr bool Is_G(const char* path) {
         return path == nullptr || path[0] == 0 ||
@@ -700,6 +1026,8 @@ namespace internal {
         // collection value
         template <typename Ty>
         inline void PushUd(Ty&& obj, ICollection* collection) {
+            QuotaLift lift(&budget_);
+            ++push_stats_.value_new;
             auto* ud = NewValueUd<Ty>(collection, std::forward<Ty>(obj));
             SetMetatable(collection);
 
@@ -710,14 +1038,18 @@ namespace internal {
         // declared type value
         template <typename Ty>
         inline void PushUd(Ty&& obj, const TypeDesc* desc) {
+            QuotaLift lift(&budget_);
+            ++push_stats_.value_new;
             auto* ud = NewValueUd<Ty>(desc, std::forward<Ty>(obj));
             SetMetatable(desc);
 
             auto* data = static_cast<AliasUd*>(ud)->As<ValueData>();
-            if (desc->caster.is_multi_inherit)
+            if (desc->caster.is_multi_inherit) {
+                CheckFlushGc();
                 value_ud_refs_.insert(std::make_pair(_XLUA_TO_SUPER_PTR(ud->ptr, desc, nullptr), CacheUd()));
-            else
+            } else {
                 data->index = value_ud_ary_.Alloc(CacheUd(), data);
+            }
         }
 
         // collection ptr
@@ -728,9 +1060,13 @@ namespace internal {
                 return;
             }
 
+            CheckFlushGc();
+            QuotaLift lift(&budget_);
+
             /* lua owned object */
             auto* data = ValuePtr2DataPtr(ptr);
             if (value_ud_ary_.IsValid(data->index) && value_ud_ary_.GetValue(data->index) == data) {
+                ++push_stats_.value_hit;
                 LoadCache(value_ud_ary_.GetRef(data->index));
                 return;
             }
@@ -738,10 +1074,12 @@ namespace internal {
             /* whether cached ptr ud */
             auto it = collection_ptr_uds_.find(static_cast<void*>(ptr));
             if (it == collection_ptr_uds_.end()) {
+                ++push_stats_.collection_miss;
                 auto* ud = NewPtrUd(ptr, col);
                 SetMetatable(col);
                 collection_ptr_uds_.insert(std::make_pair(ptr, UdCache{CacheUd(), ud}));
             } else {
+                ++push_stats_.collection_hit;
                 LoadCache(it->second.ref);
             }
         }
@@ -754,16 +1092,21 @@ namespace internal {
                 return;
             }
 
+            CheckFlushGc();
+            QuotaLift lift(&budget_);
+
             /* lua owned object */
             if (desc->caster.is_multi_inherit) {
                 auto it = value_ud_refs_.find(_XLUA_TO_SUPER_PTR(ptr, desc, nullptr));
                 if (it != value_ud_refs_.end()) {
+                    ++push_stats_.value_hit;
                     LoadCache(it->second);
                     return;
                 }
             } else {
                 auto* data = ValuePtr2DataPtr(ptr);
                 if (value_ud_ary_.IsValid(data->index) && value_ud_ary_.GetValue(data->index) == data) {
+                    ++push_stats_.value_hit;
                     LoadCache(value_ud_ary_.GetRef(data->index));
                     return;
                 }
@@ -771,9 +1114,11 @@ namespace internal {
 
 #if XLUA_ENABLE_LUD_OPTIMIZE
             if (LightUd ld = PackLightUd(ptr, desc)) {
+                ++push_stats_.lud;
                 lua_pushlightuserdata(l_, ld.value);
                 return;
             }
+            ++push_stats_.lud_fallback;
 #endif // XLUA_ENABLE_LUD_OPTIMIZE
 
             if (desc->weak_index) {
@@ -782,22 +1127,27 @@ namespace internal {
                 auto* ud = cache.ud;
                 if (ud) {
                     if (ud->ref != weak_ref) {              // prev weak obj is discard
+                        ++push_stats_.weak_stale;
                         ud->ref = WeakObjRef{0, 0};         // break the reference
                         ud = NewPtrUd(weak_ref, desc);
                         SetMetatable(desc);
                         UpdateCache(cache.ref);
                         SetWeakCache(desc->weak_index, weak_ref.index, cache.ref, ud);
                     } else if (IsBaseOf(desc, ud->desc)) { // base type
+                        ++push_stats_.weak_hit;
                         LoadCache(cache.ref);
                     } else if (IsBaseOf(ud->desc, desc)) { // derived type
+                        ++push_stats_.weak_hit;
+                        ++push_stats_.derived;
                         ud->ptr = ptr;
-                        ud->desc = desc;
+                        SetUdDesc(ud, desc);
                         LoadCache(cache.ref);
                         SetMetatable(desc);
                     } else {
                         assert(false);
                     }
                 } else {
+                    ++push_stats_.weak_miss;
                     ud = NewPtrUd(weak_ref, desc);
                     SetMetatable(desc);
                     SetWeakCache(desc->weak_index, weak_ref.index, CacheUd(), ud);
@@ -808,19 +1158,24 @@ namespace internal {
                 if (it != declared_ptr_uds_.end()) {
                     auto* ud = it->second.ud;
                     if (IsBaseOf(desc, ud->desc)) {         // base type
+                        ++push_stats_.ptr_hit;
                         LoadCache(it->second.ref);
                     } else if (IsBaseOf(ud->desc, desc)) {  // derived object
+                        ++push_stats_.ptr_hit;
+                        ++push_stats_.derived;
                         ud->ptr = ptr;
-                        ud->desc = desc;
+                        SetUdDesc(ud, desc);
                         LoadCache(it->second.ref);
                         SetMetatable(desc);
                     } else {                                // new object
+                        ++push_stats_.ptr_stale;
                         ud->ptr = nullptr;                  // mark the ud is discarded
                         it->second.ud = NewPtrUd(ptr, desc);
                         SetMetatable(desc);
                         UpdateCache(it->second.ref);
                     }
                 } else {
+                    ++push_stats_.ptr_miss;
                     auto* ud = NewPtrUd(ptr, desc);
                     SetMetatable(desc);
                     declared_ptr_uds_.insert(std::make_pair(tsp, UdCache{CacheUd(), ud}));
@@ -831,19 +1186,24 @@ namespace internal {
         // smart ptr
         template <typename Ty, typename Sty>
         inline void PushSmartPtr(Ty* ptr, Sty&& s, size_t tag, const TypeDesc* desc) {
+            CheckFlushGc();
+            QuotaLift lift(&budget_);
             auto* tsp = _XLUA_TO_SUPER_PTR(ptr, desc, nullptr);
             auto it = smart_ptr_uds_.find(tsp);
             if (it == smart_ptr_uds_.end()) {
+                ++push_stats_.smart_miss;
                 auto* ud = NewSmartPtrUd(ptr, desc, std::forward<Sty>(s), tag);
                 SetMetatable(desc);
                 smart_ptr_uds_.insert(std::make_pair(tsp, UdCache{CacheUd(), ud}));
             } else {
+                ++push_stats_.smart_hit;
                 assert(static_cast<AliasUd*>(it->second.ud)->As<SmartPtrData>()->tag == tag);
                 LoadCache(it->second.ref);
                 // if the obj ptr is the derived type, update the ud info to derived type
                 if (!IsBaseOf(desc, it->second.ud->desc)) {
+                    ++push_stats_.derived;
                     it->second.ud->ptr = ptr;
-                    it->second.ud->desc = desc;
+                    SetUdDesc(it->second.ud, desc);
                     SetMetatable(desc);
                 }
             }
@@ -851,12 +1211,16 @@ namespace internal {
 
         template <typename Ty, typename Sty>
         inline void PushSmartPtr(Ty* ptr, Sty&& s, size_t tag, ICollection* col) {
+            CheckFlushGc();
+            QuotaLift lift(&budget_);
             auto it = smart_ptr_uds_.find(ptr);
             if (it == smart_ptr_uds_.end()) {
+                ++push_stats_.smart_miss;
                 auto* ud = NewSmartPtrUd(ptr, col, std::forward<Sty>(s), tag);
                 SetMetatable(col);
                 smart_ptr_uds_.insert(std::make_pair(ptr, UdCache{CacheUd(), ud}));
             } else {
+                ++push_stats_.smart_hit;
                 assert(static_cast<AliasUd*>(it->second.ud)->As<SmartPtrData>()->tag == tag);
                 LoadCache(it->second.ref);
             }
@@ -865,19 +1229,58 @@ namespace internal {
         template <typename... Args>
         inline FullUd* NewPtrUd(Args... args) {
             auto* d = lua_newuserdata(l_, sizeof(FullUd));
-            return new (d) FullUd(args...);
+            auto* ud = new (d) FullUd(args...);
+            if (track_ud_)
+                CountUd(ud, 1, true);
+            return ud;
         }
 
         template <typename Ty, typename Dy, typename... Args>
         inline FullUd* NewValueUd(Dy info, Args&&... args) {
             void* m = (void*)lua_newuserdata(l_, sizeof(ValueUd<Ty>));
-            return new (m) ValueUd<Ty>(info, std::forward<Args>(args)...);
+            FullUd* ud = new (m) ValueUd<Ty>(info, std::forward<Args>(args)...);
+            if (track_ud_)
+                CountUd(ud, 1, true);
+            return ud;
         }
 
         template <typename Ty, typename Dy, typename Sy>
         inline FullUd* NewSmartPtrUd(Ty* ptr, Dy desc, Sy&& s, size_t tag) {
             void* d = (void*)lua_newuserdata(l_, sizeof(SmartPtrUd<Sy>));
-            return new (d) SmartPtrUd<Sy>(ptr, desc, std::forward<Sy>(s), tag);
+            FullUd* ud = new (d) SmartPtrUd<Sy>(ptr, desc, std::forward<Sy>(s), tag);
+            if (track_ud_)
+                CountUd(ud, 1, true);
+            return ud;
+        }
+
+        /* the userdata is updated to derived type */
+        inline void SetUdDesc(FullUd* ud, const TypeDesc* desc) {
+            if (track_ud_) {
+                CountUd(ud, -1);
+                ud->desc = desc;
+                CountUd(ud, 1);
+            } else {
+                ud->desc = desc;
+            }
+        }
+
+        /* live userdata count of the type, the type changes when updated to derived type
+         * only the userdata created in this session are counted, the older ones would make it negative
+        */
+        void CountUd(FullUd* ud, int delta, bool created = false) {
+            if (created)
+                ud->session = ud_session_;
+            else if (ud->session != ud_session_)
+                return;
+
+            auto& stat = ud_stats_[ud->desc];   // desc and collection share the storage
+            if (stat.type == nullptr)
+                stat.type = ud->major == UdMajor::kCollection ? ud->collection->Name() : ud->desc->name;
+
+            int kind = (int)ud->minor - (int)UdMinor::kPtr;
+            stat.live[kind] += delta;
+            if (created)
+                ++stat.created[kind];
         }
 
         template <typename Ty, typename... Args>
@@ -905,16 +1308,22 @@ namespace internal {
         int RefObj(int index) {
             int lty = lua_type(l_, index);
             //TODO: lua thread?
-            if (lty != LUA_TTABLE && lty != LUA_TUSERDATA && lty != LUA_TFUNCTION)
+            if (lty != LUA_TTABLE && lty != LUA_TUSERDATA && lty != LUA_TFUNCTION && lty != LUA_TSTRING)
                 return 0;
 
             // reference lua object
             int ref = 0;
             index = lua_absindex(l_, index);
             lua_rawgeti(l_, LUA_REGISTRYINDEX, obj_ref_);   // load cache table
+            if (free_obj_refs_.empty()) {
+                ref = (int)lua_rawlen(l_, -1) + 1;
+            } else {
+                ref = free_obj_refs_.back();
+                free_obj_refs_.pop_back();
+            }
             lua_pushvalue(l_, index);                       // copy data
-            ref = luaL_ref(l_, -2);                         // ref top stack user data
-            lua_remove(l_, -1);                             // remove cache table
+            lua_rawseti(l_, -2, ref);                       // cache[ref] = data
+            lua_pop(l_, 1);                                 // remove cache table
 
             return obj_ary_.Alloc(ref, 1);
         }
@@ -943,9 +1352,14 @@ namespace internal {
             if (count) {
                 obj_ary_.SetValue(obj_idx, count);
             } else {
+                /* keep the slot alive with false, the nil hole of luaL_unref makes
+                 * the cache table rehash when refs are taken and released in turn */
+                int ref = obj_ary_.GetRef(obj_idx);
                 lua_rawgeti(l_, LUA_REGISTRYINDEX, obj_ref_);   // load cache table
-                luaL_unref(l_, -1, obj_ary_.GetRef(obj_idx));   // unref
+                lua_pushboolean(l_, 0);
+                lua_rawseti(l_, -2, ref);                       // cache[ref] = false
                 lua_pop(l_, 1);                                 // pop cache table
+                free_obj_refs_.push_back(ref);
                 obj_ary_.Free(obj_idx);
             }
         }
@@ -985,7 +1399,7 @@ namespace internal {
 
         inline void SetWeakCache(int weak_index, int obj_index, int ref, FullUd* ud) {
             if (weak_index >= (int)weak_obj_caches_.size())
-                weak_obj_caches_.resize(weak_index + 1);
+                weak_obj_caches_.resize(weak_index + 1, BudgetVector<UdCache>(&budget_));
 
             auto& objs = weak_obj_caches_[weak_index];
             if (obj_index >= (int)objs.size())
@@ -994,60 +1408,188 @@ namespace internal {
             objs[obj_index] = UdCache{ref, ud};
         }
 
-        /* user data gc */
+        /* user data gc, only record the cache, released by FlushGc */
         void OnGc(FullUd* ud) {
-            int ref = LUA_NOREF;
+            if (track_ud_)
+                CountUd(ud, -1);
+
+            GcPending pending{GcPending::Kind::kRef, LUA_NOREF, 0, 0, nullptr, ud};
             if (ud->minor == UdMinor::kPtr) {
                 if (ud->major == UdMajor::kCollection) {
-                    auto it = collection_ptr_uds_.find(ud->ptr);
-                    ref = it->second.ref;
-                    collection_ptr_uds_.erase(it);
+                    pending.kind = GcPending::Kind::kCollectionPtr;
+                    pending.key = ud->ptr;
                 } else if (ud->major == UdMajor::kDeclaredType) {
-                    if (ud->ptr) {  // need check the user data whether is discard
-                        if (ud->desc->weak_index) {
-                            ref = GetWeakCache(ud->desc->weak_index, ud->ref.index).ref;
-                            SetWeakCache(ud->desc->weak_index, ud->ref.index, LUA_NOREF, nullptr);
-                        } else {
-                            auto it = declared_ptr_uds_.find(_XLUA_TO_SUPER_PTR(ud->ptr, ud->desc, nullptr));
-                            ref = it->second.ref;
-                            declared_ptr_uds_.erase(it);
-                        }
+                    if (ud->ptr == nullptr)   // the user data is discard
+                        return;
+
+                    if (ud->desc->weak_index) {
+                        pending.kind = GcPending::Kind::kWeakObj;
+                        pending.weak_index = ud->desc->weak_index;
+                        pending.obj_index = ud->ref.index;
+                    } else {
+                        pending.kind = GcPending::Kind::kDeclaredPtr;
+                        pending.key = _XLUA_TO_SUPER_PTR(ud->ptr, ud->desc, nullptr);
                     }
                 }
             } else if (ud->minor == UdMinor::kSmartPtr) {
-                void* ptr = ud->ptr;
+                pending.kind = GcPending::Kind::kSmartPtr;
+                pending.key = ud->ptr;
                 if (ud->major == UdMajor::kDeclaredType)
-                    ptr = _XLUA_TO_SUPER_PTR(ud->ptr, ud->desc, nullptr);
-
-                auto it = smart_ptr_uds_.find(ptr);
-                ref = it->second.ref;
-                smart_ptr_uds_.erase(it);
+                    pending.key = _XLUA_TO_SUPER_PTR(ud->ptr, ud->desc, nullptr);
 
-                static_cast<AliasUd*>(ud)->As<IObjData>()->~IObjData();
+                DestroyData(static_cast<AliasUd*>(ud)->As<IObjData>());
             } else if (ud->minor == UdMinor::kValue) {
                 auto* data = static_cast<AliasUd*>(ud)->As<ValueData>();
                 if (ud->major == UdMajor::kDeclaredType && ud->desc->caster.is_multi_inherit) {
-                    auto it = value_ud_refs_.find(_XLUA_TO_SUPER_PTR(ud->ptr, ud->desc, nullptr));
-                    ref = it->second;
-                    value_ud_refs_.erase(it);
+                    pending.kind = GcPending::Kind::kValueRef;
+                    pending.key = _XLUA_TO_SUPER_PTR(ud->ptr, ud->desc, nullptr);
                 } else {
-                    ref = value_ud_ary_.GetRef(data->index);
+                    pending.ref = value_ud_ary_.GetRef(data->index);
                     value_ud_ary_.Free(data->index);
                 }
-                data->~ValueData();
+                DestroyData(data);
             } else {
                 assert(false);
             }
 
-            if (ref != LUA_NOREF) {
-                lua_rawgeti(l_, LUA_REGISTRYINDEX, cache_ref_); // load cache table
-                luaL_unref(l_, -1, ref);                        // unref cache data
-                lua_pop(l_, 1);                                 // remove cache table
+            gc_pending_.push_back(pending);
+            if (gc_pending_.size() >= XLUA_CONTAINER_INCREMENTAL)
+                FlushGc();
+        }
+
+        /* release the caches of collected userdata,
+         * must be called before looking up the caches, the dead entry may collide with new object
+        */
+        inline void CheckFlushGc() {
+            if (!gc_pending_.empty())
+                FlushGc();
+        }
+
+        void FlushGc() {
+            lua_rawgeti(l_, LUA_REGISTRYINDEX, cache_ref_); // load cache table
+            for (const auto& pending : gc_pending_) {
+                int ref = pending.ref;
+                switch (pending.kind) {
+                case GcPending::Kind::kCollectionPtr:
+                    ref = EraseCache(collection_ptr_uds_, pending);
+                    break;
+                case GcPending::Kind::kDeclaredPtr:
+                    ref = EraseCache(declared_ptr_uds_, pending);
+                    break;
+                case GcPending::Kind::kSmartPtr:
+                    ref = EraseCache(smart_ptr_uds_, pending);
+                    break;
+                case GcPending::Kind::kWeakObj: {
+                    auto cache = GetWeakCache(pending.weak_index, pending.obj_index);
+                    if (cache.ud == pending.ud) {
+                        ref = cache.ref;
+                        SetWeakCache(pending.weak_index, pending.obj_index, LUA_NOREF, nullptr);
+                    }
+                    break;
+                }
+                case GcPending::Kind::kValueRef: {
+                    auto it = value_ud_refs_.find(pending.key);
+                    if (it != value_ud_refs_.end()) {
+                        ref = it->second;
+                        value_ud_refs_.erase(it);
+                    }
+                    break;
+                }
+                default:
+                    break;
+                }
+
+                if (ref != LUA_NOREF)
+                    luaL_unref(l_, -1, ref);                // unref cache data
+            }
+            lua_pop(l_, 1);                                 // remove cache table
+            gc_pending_.clear();
+        }
+
+        template <typename Map>
+        static inline int EraseCache(Map& caches, const GcPending& pending) {
+            auto it = caches.find(pending.key);
+            if (it == caches.end() || it->second.ud != pending.ud)
+                return LUA_NOREF;
+
+            int ref = it->second.ref;
+            caches.erase(it);
+            return ref;
+        }
+
+#if XLUA_ENABLE_CALL_STATS
+        static inline uint64_t NowNs() {
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        inline CallMark BeginCall(int id) {
+            if (id >= (int)call_stats_.size())
+                call_stats_.resize(id + 1);
+            ++call_stats_[id].calls;
+
+            CallMark mark{id, call_id_, 0};
+            call_id_ = id;
+            mark.begin = NowNs();
+            return mark;
+        }
+
+        /* not reached if the call raise error or yield */
+        inline void EndCall(const CallMark& mark) {
+            uint64_t ns = NowNs() - mark.begin;
+            auto& stat = call_stats_[mark.id];
+            stat.total_ns += ns;
+            if (ns > stat.max_ns)
+                stat.max_ns = ns;
+
+            int bucket = 0;
+            for (uint64_t v = ns >> 7; v && bucket < CallStat::kHistNum - 1; v >>= 1)
+                ++bucket;
+            ++stat.hist[bucket];
+            call_id_ = mark.prev;
+        }
+#endif // XLUA_ENABLE_CALL_STATS
+
+        inline void OnCallFailed() {
+#if XLUA_ENABLE_CALL_STATS
+            if (call_id_ >= 0 && call_id_ < (int)call_stats_.size())
+                ++call_stats_[call_id_].failed;
+#endif // XLUA_ENABLE_CALL_STATS
+        }
+
+        inline void PushKey(const Key& key) {
+            int id = key.GetId();
+            if (id < (int)key_refs_.size() && key_refs_[id] != LUA_NOREF)
+                lua_rawgeti(l_, LUA_REGISTRYINDEX, key_refs_[id]);
+            else
+                InternKey(key);
+        }
+
+        /* pin the key string in the registry and push it */
+        void InternKey(const Key& key) {
+            int id = key.GetId();
+            if (id >= (int)key_refs_.size())
+                key_refs_.resize(id + 1, LUA_NOREF);
+
+            lua_pushlstring(l_, key.GetStr(), key.GetLen());
+            lua_pushvalue(l_, -1);
+            key_refs_[id] = luaL_ref(l_, LUA_REGISTRYINDEX);
+        }
+
+        /* move the payload to deferred queue if need, the moved-from object is cheap to destroy */
+        inline void DestroyData(IObjData* data) {
+            if (closing_) {
+                /* the state is closing, nobody would drain the queue */
+            } else if (auto* d = data->Detach(defer_all_)) {
+                deferred_.push_back(d);
             }
+            data->~IObjData();
         }
 
         const char* module_;
-        lua_State* l_;
+        lua_State* l_;          // running thread, may be a coroutine
+        lua_State* main_;       // main thread
+        PoolAlloc* alloc_;      // pool allocator, null if not use
         bool is_attach_;
         int desc_ref_;
         int meta_ref_;
@@ -1056,16 +1598,48 @@ namespace internal {
         int obj_ref_;
         int cache_ref_;
 
+        /* memory budget, must be constructed before the containers */
+        MemBudget budget_;
         /* ref lua objects, such as table, function, user data*/
-        LuaObjRefArray<int> obj_ary_{0};
+        LuaObjRefArray<int> obj_ary_{0, &budget_};
+        BudgetVector<int> free_obj_refs_{&budget_};
+        /* interned keys, index by Key::GetId */
+        BudgetVector<int> key_refs_{&budget_};
         /* lua owned userdata */
-        LuaObjRefArray<ValueData*> value_ud_ary_{nullptr};
-        std::unordered_map<void*, int> value_ud_refs_;
+        LuaObjRefArray<ValueData*> value_ud_ary_{nullptr, &budget_};
+        BudgetMap<void*, int> value_ud_refs_{&budget_};
         /* */
-        std::unordered_map<void*, UdCache> collection_ptr_uds_;
-        std::unordered_map<void*, UdCache> declared_ptr_uds_;
-        std::unordered_map<void*, UdCache> smart_ptr_uds_;
-        std::vector<std::vector<UdCache>> weak_obj_caches_;
+        BudgetMap<void*, UdCache> collection_ptr_uds_{&budget_};
+        BudgetMap<void*, UdCache> declared_ptr_uds_{&budget_};
+        BudgetMap<void*, UdCache> smart_ptr_uds_{&budget_};
+        BudgetVector<BudgetVector<UdCache>> weak_obj_caches_{&budget_};
+        /* coroutines waiting for async result */
+        LuaObjRefArray<std::shared_ptr<AsyncData>> async_ary_{nullptr, &budget_};
+        /* coroutine scheduler */
+        Scheduler scheduler_;
+        /* frame budgeted gc */
+        GcControl gc_;
+        /* collected userdata waiting for cache release */
+        BudgetVector<GcPending> gc_pending_{&budget_};
+        /* sampling profiler, null if not started */
+        Profiler* profiler_ = nullptr;
+        /* userdata push path statistics */
+        PushStats push_stats_;
+        StartupStats startup_;
+        /* heap attribution, null if not started */
+        HeapProfiler* heap_profiler_ = nullptr;
+        lua_State* resuming_ = nullptr;     // coroutine resumed by xlua
+        LogFunc log_ = nullptr;             // printf if null
+        bool track_ud_ = false;
+        uint8_t ud_session_ = 0;
+        std::unordered_map<const void*, UdStat> ud_stats_;
+        /* export member call statistics, index by RegisterCallStat */
+        int call_id_ = -1;
+        std::vector<CallStat> call_stats_;
+        /* payloads waiting for destruction */
+        bool defer_all_ = false;
+        bool closing_ = false;      // destroy the payloads directly while closing
+        std::vector<IObjData*> deferred_;
     }; // calss state_data
 } // namespace internal
 
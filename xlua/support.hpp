@@ -24,12 +24,14 @@ namespace internal {
     struct void_tag {};
     struct enum_tag {};
     struct declared_tag {};
+    struct struct_tag {};
 
-    /* traits dispacth tag, declared/enum/void tag */
+    /* traits dispacth tag, declared/struct/enum/void tag */
     template <typename Ty>
     struct DisaptchTag {
         typedef typename std::conditional<IsLuaType<Ty>::value, declared_tag,
-                typename std::conditional<std::is_enum<Ty>::value, enum_tag, void_tag>::type>::type type_tag;
+                typename std::conditional<IsLuaStruct<Ty>::value, struct_tag,
+                typename std::conditional<std::is_enum<Ty>::value, enum_tag, void_tag>::type>::type>::type type_tag;
     };
 
     template <typename Ty>
@@ -85,6 +87,29 @@ namespace internal {
         static inline const char* Name() { return TypeInfo()->name;  }
     };
 
+    /* declared struct, implement in core.cpp */
+    void PushStruct(State* s, const StructDesc* desc, const void* obj);
+    void LoadStruct(State* s, int index, const StructDesc* desc, void* obj);
+
+    /* declared struct support, convert with lua table by value */
+    template <typename Ty>
+    struct ExportSupport<Ty, struct_tag> : ValueCategory<Ty, false> {
+        static inline const StructDesc* Desc() { return xLuaGetStructDesc(Identity<Ty>()); }
+        static inline const char* Name() { return Desc()->name; }
+        static inline bool Check(State* s, int index) {
+            return lua_type(s->GetLuaState(), index) == LUA_TTABLE;
+        }
+        static inline Ty Load(State* s, int index) {
+            Ty obj;
+            if (lua_type(s->GetLuaState(), index) == LUA_TTABLE)
+                LoadStruct(s, index, Desc(), &obj);
+            return obj;
+        }
+        static inline void Push(State* s, const Ty& obj) {
+            PushStruct(s, Desc(), &obj);
+        }
+    };
+
     /* enum support */
     template <typename Ty>
     struct ExportSupport<Ty, enum_tag> : ValueCategory<Ty, false> {
@@ -150,11 +175,77 @@ namespace internal {
         }
     };
 
-    /* collection support */
+    /* convert lua table to container, the elements are appended */
+    template <typename Ty, typename Alloc>
+    void LoadTable(State* s, int index, std::vector<Ty, Alloc>& vec);
+    template <typename Ty, typename Alloc>
+    void LoadTable(State* s, int index, std::list<Ty, Alloc>& lst);
+    template <typename Ky, typename Vy, typename Cmp, typename Alloc>
+    void LoadTable(State* s, int index, std::map<Ky, Vy, Cmp, Alloc>& map);
+    template <typename Ky, typename Vy, typename Hash, typename Eq, typename Alloc>
+    void LoadTable(State* s, int index, std::unordered_map<Ky, Vy, Hash, Eq, Alloc>& map);
+
+    /* push container as lua sequence or key/value table */
+    template <typename Container>
+    void PushSequence(State* s, const Container& container);
+    template <typename MapTy>
+    void PushPairs(State* s, const MapTy& map);
+
+    /* collection loaded by value
+     * refers the collection userdata or owns the container converted from lua table
+    */
+    template <typename Ty>
+    struct CollectionWrapper {
+        CollectionWrapper(Ty* p) : ptr_(p) {}
+        CollectionWrapper(Ty&& val) : val_(std::move(val)), ptr_(&val_) {}
+        CollectionWrapper(CollectionWrapper&& other)
+            : val_(std::move(other.val_)), ptr_(other.ptr_ == &other.val_ ? &val_ : other.ptr_) {}
+
+        inline bool IsValid() const { return ptr_ != nullptr; }
+        inline operator Ty&() const { return *ptr_; }
+
+    private:
+        Ty val_;
+        Ty* ptr_;
+    };
+
+    /* the supporter converts lua table to a temporary value */
+    struct table_value_tag {};
+
+    /* non-const reference parameter could not refer the temporary converted from lua table */
+    template <typename Ty>
+    struct IsTableRef {
+        static constexpr bool value = std::is_lvalue_reference<Ty>::value &&
+            !std::is_const<typename std::remove_reference<Ty>::type>::value &&
+            std::is_base_of<table_value_tag, typename SupportTraits<Ty>::supporter>::value;
+    };
+
+    /* collection support, the value is accepted from lua table as well */
     template <typename Ty, typename CollTy>
-    struct CollectionSupport : ObjectSupport<Ty> {
+    struct CollectionSupport : ObjectCategory<CollectionWrapper<Ty>>, table_value_tag {
+        typedef Support<Ty*> supporter;
+
         static inline ICollection* TypeInfo() { return &coll_; }
         static inline const char* Name() { return TypeInfo()->Name(); }
+
+        static inline bool Check(State* l, int index) {
+            return lua_type(l->GetLuaState(), index) == LUA_TTABLE || supporter::Load(l, index) != nullptr;
+        }
+        static inline CollectionWrapper<Ty> Load(State* l, int index) {
+            if (lua_type(l->GetLuaState(), index) != LUA_TTABLE)
+                return CollectionWrapper<Ty>(supporter::Load(l, index));
+
+            Ty val;
+            LoadTable(l, index, val);
+            return CollectionWrapper<Ty>(std::move(val));
+        }
+        static inline void Push(State* l, const Ty& obj) {
+            l->state_.PushUd(obj, supporter::TypeInfo());
+        }
+        static inline void Push(State* l, Ty&& obj) {
+            l->state_.PushUd(std::move(obj), supporter::TypeInfo());
+        }
+
     private:
         static CollTy coll_;
     };
@@ -181,6 +272,11 @@ struct Support<Variant> : ValueCategory<Variant, true> {
     static inline bool Check(State* s, int index) { return true; }
 
     static inline Variant Load(State* s, int index) {
+        return Load(s, index, false);
+    }
+
+    /* ref_str: the long string refers the lua string instead of copy */
+    static inline Variant Load(State* s, int index, bool ref_str) {
         auto* l = s->GetLuaState();
         int lty = lua_type(l, index);
         size_t len = 0;
@@ -201,12 +297,14 @@ struct Support<Variant> : ValueCategory<Variant, true> {
             return Variant(ptr);
         case LUA_TNUMBER:
             if (lua_isinteger(l, index))
-                return Variant(lua_tointeger(l, index));
+                return Variant((int64_t)lua_tointeger(l, index));
             else
                 return Variant(lua_tonumber(l, index));
         case LUA_TSTRING:
             str = lua_tolstring(l, index, &len);
-            return Variant(str, len);
+            if (!ref_str || len <= Variant::kCopyStrLen)
+                return Variant(str, len);
+            return Variant(str, len, s->state_.RefObj(index), s);
         case LUA_TTABLE:
             return Variant(VarType::kTable, s->state_.RefObj(index), s);
         case LUA_TFUNCTION:
@@ -234,7 +332,11 @@ struct Support<Variant> : ValueCategory<Variant, true> {
             else lua_pushnumber(l, var.number_);
             break;
         case VarType::kString:
-            lua_pushlstring(l, var.str_.c_str(), var.str_.length());
+            /* the refered string belongs to the state it loaded from */
+            if (var.obj_.IsValid() && var.obj_.GetState() == s)
+                var.obj_.Push();
+            else
+                lua_pushlstring(l, var.ToCStr(), var.StrLen());
             break;
         case VarType::kTable:
         case VarType::kFunction:
@@ -265,6 +367,10 @@ struct Support<Variant> : ValueCategory<Variant, true> {
     }
 };
 
+inline Variant State::GetVariant(int index, bool ref_str) {
+    return Support<Variant>::Load(this, index, ref_str);
+}
+
 template <>
 struct Support<Table> : ValueCategory<Table, true> {
     static inline const char* Name() { return "xlua::Table"; }
@@ -455,6 +561,17 @@ struct Support<internal::StringView> : ValueCategory<internal::StringView, true>
     }
 };
 
+/* interned key, only push */
+template <>
+struct Support<Key> : ValueCategory<Key, false> {
+    static inline const char* Name() { return "xlua::Key"; }
+    static inline bool Check(State* s, int index) { return false; }
+    static inline void Load(State* s, int index) = delete;
+    static inline void Push(State* s, const Key& key) {
+        s->state_.PushKey(key);
+    }
+};
+
 /* only used for check is nil */
 template <>
 struct Support<void> : ValueCategory<void, false> {
@@ -531,6 +648,8 @@ namespace internal {
     inline bool DoCheckParam(State* s, int index) {
         static_assert(SupportTraits<Ty>::is_support, "not xlua support type");
         using supporter = typename SupportTraits<Ty>::supporter;
+        if (IsTableRef<Ty>::value && lua_type(s->GetLuaState(), index) == LUA_TTABLE)
+            return false;
         return lua_isnil(s->GetLuaState(), index) || supporter::Check(s, index);
     }
 
@@ -538,6 +657,8 @@ namespace internal {
     inline bool DoCheckParam(State* s, int index) {
         static_assert(SupportTraits<Ty>::is_support, "not xlua support type");
         using supporter = typename SupportTraits<Ty>::supporter;
+        if (IsTableRef<Ty>::value && lua_type(s->GetLuaState(), index) == LUA_TTABLE)
+            return false;
         return supporter::Check(s, index);
     }
 
@@ -573,6 +694,35 @@ namespace internal {
         return ParamChecker<sizeof...(Args)>::template Do<Args...>(s, index);
     }
 
+    /* type erased parameter, shared by all the signatures */
+    struct ParamDesc {
+        bool (*check)(State* s, int index);
+        const char* (*name)();
+    };
+
+    /* compact signature descriptor, shared by the functions with the same parameters */
+    struct CallDesc {
+        size_t param_num;
+        const ParamDesc* params;
+    };
+
+    template <typename... Args>
+    struct CallDescOf {
+        static const ParamDesc params[sizeof...(Args) + 1];
+        static const CallDesc value;
+    };
+
+    template <typename... Args>
+    const ParamDesc CallDescOf<Args...>::params[sizeof...(Args) + 1] = {
+        ParamDesc{&DoCheckParam<Args>, &SupportTraits<Args>::supporter::Name}..., ParamDesc{nullptr, nullptr}
+    };
+
+    template <typename... Args>
+    const CallDesc CallDescOf<Args...>::value = {sizeof...(Args), CallDescOf<Args...>::params};
+
+    bool CheckParameters(State* s, int index, const CallDesc& desc);
+    char* GetParameterNames(char* buff, size_t len, State* s, int index, const CallDesc& desc);
+
     template <typename Ty>
     inline void PushRetVal(State* s, Ty& val, std::true_type) {
         s->Push(&val);
@@ -594,11 +744,73 @@ namespace internal {
         PushRetVal(s, std::forward<Ty>(val), tag());
     }
 
+    template <typename Ty>
+    struct IsAsync : std::false_type {};
+
+    template <typename Ty>
+    struct IsAsync<Async<Ty>> : std::true_type {};
+
+    static constexpr int kAsyncWait = -1;   // yield the running coroutine
+    static constexpr int kAsyncError = -2;  // error message is on the top stack
+
+    template <typename Ry, typename Ty, typename std::enable_if<!IsAsync<typename std::decay<Ty>::type>::value, int>::type = 0>
+    inline int PushRet(State* s, Ty&& val) {
+        PushRetVal<Ry>(s, std::forward<Ty>(val));
+        return 1;
+    }
+
+    template <typename Ry, typename Ty>
+    inline int PushRet(State* s, const Async<Ty>& val) {
+        const auto& data = val.GetData();
+        if (data->ready) {
+            if (data->ok) {
+                data->PushValue(s);
+                return 1;
+            }
+            lua_pushstring(s->GetLuaState(), data->error.c_str());
+            return kAsyncError;
+        }
+
+        if (data->state) {
+            lua_pushstring(s->GetLuaState(), "async result is already waited by other coroutine");
+            return kAsyncError;
+        }
+
+        if (!lua_isyieldable(s->GetLuaState())) {
+            lua_pushstring(s->GetLuaState(), "attempt to wait async result outside a coroutine");
+            return kAsyncError;
+        }
+
+        WaitAsync(s, data);
+        return kAsyncWait;
+    }
+
+    /* continue the coroutine resumed by async result, stack top is [ok, value/error] */
+    inline int ContinueAsync(lua_State* l, int status, lua_KContext ctx) {
+        State* s = GetState(l);
+        if (s->state_.resuming_ != l) {     // resumed by lua, the result is not ready
+            CancelAsync(s, l);
+            return luaL_error(l, "async call is resumed unexpectedly");
+        }
+        if (!lua_toboolean(l, -2))
+            return lua_error(l);
+        return 1;
+    }
+
+    /* the returned value must not be holded by any c++ object on stack when yield */
+    inline int ReturnOrYield(State* s, int ret) {
+        if (ret >= 0)
+            return ret;
+        if (ret == kAsyncError)
+            return lua_error(s->GetLuaState());
+        return lua_yieldk(s->GetLuaState(), 0, 0, &ContinueAsync);
+    }
+
     template <typename Fy, typename Ry, typename... Args, size_t... Idxs>
     inline auto DoLuaCall(State* s, Fy f, index_sequence<Idxs...>) -> typename std::enable_if<!std::is_void<Ry>::value, int>::type {
         if (CheckParameters<Args...>(s, 1)) {
-            PushRetVal<Ry>(s, f(SupportTraits<Args>::supporter::Load(s, Idxs + 1)...));
-            return 1;
+            int ret = PushRet<Ry>(s, f(SupportTraits<Args>::supporter::Load(s, Idxs + 1)...));
+            return ReturnOrYield(s, ret);
         } else {
             char buff[1024];
             luaL_error(s->GetLuaState(), "attemp to call export function failed, paramenter is not accpeted,\nparams{%s}",
@@ -676,21 +888,21 @@ struct Support<int(State*)> : ValueCategory<int(State*), true>{
         lua_getupvalue(s->GetLuaState(), index, 1);
         void* f = lua_touserdata(s->GetLuaState(), -1);
         lua_pop(s->GetLuaState(), 1);
-        return static_cast<value_type>(f);
+        return reinterpret_cast<value_type>(f);
     }
 
     static inline void Push(State* s, value_type f) {
         if (!f) {
             lua_pushnil(s->GetLuaState());
         } else {
-            lua_pushlightuserdata(s->GetLuaState(), static_cast<void*>(f));
+            lua_pushlightuserdata(s->GetLuaState(), reinterpret_cast<void*>(f));
             lua_pushcclosure(s->GetLuaState(), &Call, 1);
         }
     }
 
 private:
     static int Call(lua_State* l) {
-        auto* f = static_cast<value_type>(lua_touserdata(l, lua_upvalueindex(1)));
+        auto* f = reinterpret_cast<value_type>(lua_touserdata(l, lua_upvalueindex(1)));
         return f(internal::GetState(l));
     };
 };
@@ -713,21 +925,21 @@ struct Support<Ry(Args...)> : ValueCategory<Ry(Args...), true> {
         lua_getupvalue(s->GetLuaState(), index, 1);
         void* f = lua_touserdata(s->GetLuaState(), -1);
         lua_pop(s->GetLuaState(), 1);
-        return static_cast<value_type>(f);
+        return reinterpret_cast<value_type>(f);
     }
 
     static inline void Push(State* s, value_type f) {
         if (!f) {
             lua_pushnil(s->GetLuaState());
         } else {
-            lua_pushlightuserdata(s->GetLuaState(), static_cast<void*>(f));
+            lua_pushlightuserdata(s->GetLuaState(), reinterpret_cast<void*>(f));
             lua_pushcclosure(s->GetLuaState(), &Call, 1);
         }
     }
 
 private:
     static int Call(lua_State* l) {
-        auto f = static_cast<value_type>(lua_touserdata(l, lua_upvalueindex(1)));
+        auto f = reinterpret_cast<value_type>(lua_touserdata(l, lua_upvalueindex(1)));
         return internal::DoLuaCall<value_type, Ry, Args...>(internal::GetState(l), f);
     }
 };
@@ -867,11 +1079,6 @@ private:
 template <typename Ty>
 size_t Support<std::shared_ptr<Ty>>::tag_ = typeid(std_shared_ptr_tag).hash_code();
 
-///* std::array support */
-//template <typename Ty, size_t N>
-//struct Support<std::array<Ty, N>> : ValueCategory<std::array<Ty, N>, true> {
-//};
-
 namespace internal {
     /* vector collection processor
      * index begin from 1, like lua style
@@ -943,6 +1150,17 @@ namespace internal {
             As(obj)->clear();
         }
 
+        bool ToTable(void* obj, State* s) override {
+            PushSequence(s, *As(obj));
+            return true;
+        }
+
+        bool FromTable(void* obj, State* s, int index) override {
+            As(obj)->clear();
+            LoadTable(s, index, *As(obj));
+            return true;
+        }
+
     protected:
         static inline vector_type* As(void* obj) { return static_cast<vector_type*>(obj); }
 
@@ -1061,6 +1279,17 @@ namespace internal {
             As(obj)->clear();
         }
 
+        bool ToTable(void* obj, State* s) override {
+            PushSequence(s, *As(obj));
+            return true;
+        }
+
+        bool FromTable(void* obj, State* s, int index) override {
+            As(obj)->clear();
+            LoadTable(s, index, *As(obj));
+            return true;
+        }
+
     protected:
         static inline list_type* As(void* obj) { return static_cast<list_type*>(obj); }
 
@@ -1203,6 +1432,17 @@ namespace internal {
             As(obj)->clear();
         }
 
+        bool ToTable(void* obj, State* s) override {
+            PushPairs(s, *As(obj));
+            return true;
+        }
+
+        bool FromTable(void* obj, State* s, int index) override {
+            As(obj)->clear();
+            LoadTable(s, index, *As(obj));
+            return true;
+        }
+
     protected:
         static inline map_type* As(void* obj) { return static_cast<map_type*>(obj); }
 
@@ -1294,4 +1534,263 @@ struct Support<std::unordered_map<KeyType, ValueType, Hash, KeyEqual, Alloc>*>
     internal::UnorderedMapColl<std::unordered_map<KeyType, ValueType, Hash, KeyEqual, Alloc>>> {
 };
 
+namespace internal {
+    /* load element of the converted table, number is loaded without type check */
+    template <typename Ty, bool = std::is_arithmetic<Ty>::value && !std::is_same<Ty, bool>::value>
+    struct TableElem {
+        typedef typename SupportTraits<Ty>::supporter supporter;
+        static_assert(SupportTraits<Ty>::is_support, "not support element type");
+
+        static inline Ty Load(State* s, int index) {
+            if (supporter::Check(s, index))
+                return supporter::Load(s, index);
+            return Ty();
+        }
+    };
+
+    template <typename Ty>
+    struct TableElem<Ty, true> {
+        static inline Ty Load(State* s, int index) {
+            return Support<Ty>::Load(s, index);
+        }
+    };
+
+    /* load the sequence of table, fn(Ty&& value) */
+    template <typename Ty, typename Fn>
+    inline void LoadSequence(State* s, int index, size_t len, Fn&& fn) {
+        lua_State* l = s->GetLuaState();
+        luaL_checkstack(l, 2, nullptr);
+        for (size_t i = 1; i <= len; ++i) {
+            lua_rawgeti(l, index, (lua_Integer)i);
+            fn(TableElem<Ty>::Load(s, -1));
+            lua_pop(l, 1);
+        }
+    }
+
+    /* load the key/value pairs of table, fn(Ky&& key, Vy&& value)
+     * the pair is skipped if the key is not accepted, the value not accepted is loaded as default
+    */
+    template <typename Ky, typename Vy, typename Fn>
+    inline void LoadPairs(State* s, int index, Fn&& fn) {
+        typedef typename SupportTraits<Ky>::supporter key_supporter;
+        static_assert(SupportTraits<Ky>::is_support, "not support key type");
+
+        lua_State* l = s->GetLuaState();
+        luaL_checkstack(l, 3, nullptr);
+        lua_pushnil(l);
+        while (lua_next(l, index)) {
+            if (key_supporter::Check(s, -2))
+                fn(key_supporter::Load(s, -2), TableElem<Vy>::Load(s, -1));
+            lua_pop(l, 1);
+        }
+    }
+
+    template <typename Ty, typename Alloc>
+    void LoadTable(State* s, int index, std::vector<Ty, Alloc>& vec) {
+        index = lua_absindex(s->GetLuaState(), index);
+        size_t len = lua_rawlen(s->GetLuaState(), index);
+        vec.reserve(vec.size() + len);
+        LoadSequence<Ty>(s, index, len, [&vec](Ty&& val) { vec.push_back(std::move(val)); });
+    }
+
+    template <typename Ty, typename Alloc>
+    void LoadTable(State* s, int index, std::list<Ty, Alloc>& lst) {
+        index = lua_absindex(s->GetLuaState(), index);
+        size_t len = lua_rawlen(s->GetLuaState(), index);
+        LoadSequence<Ty>(s, index, len, [&lst](Ty&& val) { lst.push_back(std::move(val)); });
+    }
+
+    template <typename Ty, typename Cmp, typename Alloc>
+    void LoadTable(State* s, int index, std::set<Ty, Cmp, Alloc>& set) {
+        index = lua_absindex(s->GetLuaState(), index);
+        size_t len = lua_rawlen(s->GetLuaState(), index);
+        LoadSequence<Ty>(s, index, len, [&set](Ty&& val) { set.insert(std::move(val)); });
+    }
+
+    template <typename Ty, typename Hash, typename Eq, typename Alloc>
+    void LoadTable(State* s, int index, std::unordered_set<Ty, Hash, Eq, Alloc>& set) {
+        index = lua_absindex(s->GetLuaState(), index);
+        size_t len = lua_rawlen(s->GetLuaState(), index);
+        set.reserve(set.size() + len);
+        LoadSequence<Ty>(s, index, len, [&set](Ty&& val) { set.insert(std::move(val)); });
+    }
+
+    template <typename Ty, size_t N>
+    void LoadTable(State* s, int index, std::array<Ty, N>& ary) {
+        index = lua_absindex(s->GetLuaState(), index);
+        size_t len = std::min(lua_rawlen(s->GetLuaState(), index), N);
+        size_t i = 0;
+        LoadSequence<Ty>(s, index, len, [&ary, &i](Ty&& val) { ary[i++] = std::move(val); });
+    }
+
+    template <typename Ky, typename Vy, typename Cmp, typename Alloc>
+    void LoadTable(State* s, int index, std::map<Ky, Vy, Cmp, Alloc>& map) {
+        index = lua_absindex(s->GetLuaState(), index);
+        LoadPairs<Ky, Vy>(s, index, [&map](Ky&& key, Vy&& val) { map.emplace(std::move(key), std::move(val)); });
+    }
+
+    template <typename Ky, typename Vy, typename Hash, typename Eq, typename Alloc>
+    void LoadTable(State* s, int index, std::unordered_map<Ky, Vy, Hash, Eq, Alloc>& map) {
+        index = lua_absindex(s->GetLuaState(), index);
+        LoadPairs<Ky, Vy>(s, index, [&map](Ky&& key, Vy&& val) { map.emplace(std::move(key), std::move(val)); });
+    }
+
+    /* push the container as lua sequence */
+    template <typename Container>
+    void PushSequence(State* s, const Container& container) {
+        lua_State* l = s->GetLuaState();
+        luaL_checkstack(l, 2, nullptr);
+        lua_createtable(l, (int)container.size(), 0);
+        lua_Integer i = 0;
+        for (const auto& val : container) {
+            s->Push(val);
+            lua_rawseti(l, -2, ++i);
+        }
+    }
+
+    template <typename MapTy>
+    void PushPairs(State* s, const MapTy& map) {
+        lua_State* l = s->GetLuaState();
+        luaL_checkstack(l, 3, nullptr);
+        lua_createtable(l, 0, (int)map.size());
+        for (const auto& pair : map) {
+            s->Push(pair.first);
+            s->Push(pair.second);
+            lua_rawset(l, -3);
+        }
+    }
+
+    /* container converted with lua sequence by value */
+    template <typename Ty>
+    struct SequenceSupport : ValueCategory<Ty, false> {
+        static inline bool Check(State* s, int index) {
+            return lua_type(s->GetLuaState(), index) == LUA_TTABLE;
+        }
+        static inline Ty Load(State* s, int index) {
+            Ty val{};
+            if (lua_type(s->GetLuaState(), index) == LUA_TTABLE)
+                LoadTable(s, index, val);
+            return val;
+        }
+        static inline void Push(State* s, const Ty& val) {
+            PushSequence(s, val);
+        }
+    };
+} // namespace internal
+
+/* std::array, as lua sequence */
+template <typename Ty, size_t N>
+struct Support<std::array<Ty, N>> : internal::SequenceSupport<std::array<Ty, N>> {
+    static inline const char* Name() { return "std::array"; }
+};
+
+/* std::set, as lua sequence */
+template <typename Ty, typename Cmp, typename Alloc>
+struct Support<std::set<Ty, Cmp, Alloc>> : internal::SequenceSupport<std::set<Ty, Cmp, Alloc>> {
+    static inline const char* Name() { return "std::set"; }
+};
+
+/* std::unordered_set, as lua sequence */
+template <typename Ty, typename Hash, typename Eq, typename Alloc>
+struct Support<std::unordered_set<Ty, Hash, Eq, Alloc>> : internal::SequenceSupport<std::unordered_set<Ty, Hash, Eq, Alloc>> {
+    static inline const char* Name() { return "std::unordered_set"; }
+};
+
+namespace internal {
+    /* field of declared struct
+     * vector and map are converted with lua table by value, others use the supporter
+    */
+    template <typename Ty>
+    void PushField(State* s, const Ty& val);
+    template <typename Ty, typename Alloc>
+    void PushField(State* s, const std::vector<Ty, Alloc>& vec);
+    template <typename Ky, typename Vy, typename Cmp, typename Alloc>
+    void PushField(State* s, const std::map<Ky, Vy, Cmp, Alloc>& map);
+    template <typename Ky, typename Vy, typename Hash, typename Eq, typename Alloc>
+    void PushField(State* s, const std::unordered_map<Ky, Vy, Hash, Eq, Alloc>& map);
+
+    template <typename Ty>
+    void LoadField(State* s, int index, Ty& val);
+    template <typename Ty, typename Alloc>
+    void LoadField(State* s, int index, std::vector<Ty, Alloc>& vec);
+    template <typename Ky, typename Vy, typename Cmp, typename Alloc>
+    void LoadField(State* s, int index, std::map<Ky, Vy, Cmp, Alloc>& map);
+    template <typename Ky, typename Vy, typename Hash, typename Eq, typename Alloc>
+    void LoadField(State* s, int index, std::unordered_map<Ky, Vy, Hash, Eq, Alloc>& map);
+
+    template <typename Ty>
+    inline void PushField(State* s, const Ty& val) {
+        static_assert(SupportTraits<Ty>::is_support, "not support field type");
+        SupportTraits<Ty>::supporter::Push(s, val);
+    }
+
+    template <typename Ty, typename Alloc>
+    void PushField(State* s, const std::vector<Ty, Alloc>& vec) {
+        lua_State* l = s->GetLuaState();
+        luaL_checkstack(l, 2, nullptr);
+        lua_createtable(l, (int)vec.size(), 0);
+        for (size_t i = 0; i < vec.size(); ++i) {
+            PushField(s, vec[i]);
+            lua_rawseti(l, -2, (lua_Integer)i + 1);
+        }
+    }
+
+    template <typename MapTy>
+    void PushMapField(State* s, const MapTy& map) {
+        lua_State* l = s->GetLuaState();
+        luaL_checkstack(l, 3, nullptr);
+        lua_createtable(l, 0, (int)map.size());
+        for (const auto& pair : map) {
+            PushField(s, pair.first);
+            PushField(s, pair.second);
+            lua_rawset(l, -3);
+        }
+    }
+
+    template <typename Ky, typename Vy, typename Cmp, typename Alloc>
+    inline void PushField(State* s, const std::map<Ky, Vy, Cmp, Alloc>& map) {
+        PushMapField(s, map);
+    }
+
+    template <typename Ky, typename Vy, typename Hash, typename Eq, typename Alloc>
+    inline void PushField(State* s, const std::unordered_map<Ky, Vy, Hash, Eq, Alloc>& map) {
+        PushMapField(s, map);
+    }
+
+    /* the field keeps unchanged if the lua value is not accepted */
+    template <typename Ty>
+    inline void LoadField(State* s, int index, Ty& val) {
+        using supporter = typename SupportTraits<Ty>::supporter;
+        static_assert(SupportTraits<Ty>::is_support, "not support field type");
+        if (supporter::Check(s, index))
+            val = supporter::Load(s, index);
+    }
+
+    /* the table is converted to the field in place */
+    template <typename Container>
+    void LoadContainerField(State* s, int index, Container& container) {
+        if (lua_type(s->GetLuaState(), index) == LUA_TTABLE) {
+            container.clear();
+            LoadTable(s, index, container);
+        } else {
+            LoadField<Container>(s, index, container);
+        }
+    }
+
+    template <typename Ty, typename Alloc>
+    inline void LoadField(State* s, int index, std::vector<Ty, Alloc>& vec) {
+        LoadContainerField(s, index, vec);
+    }
+
+    template <typename Ky, typename Vy, typename Cmp, typename Alloc>
+    inline void LoadField(State* s, int index, std::map<Ky, Vy, Cmp, Alloc>& map) {
+        LoadContainerField(s, index, map);
+    }
+
+    template <typename Ky, typename Vy, typename Hash, typename Eq, typename Alloc>
+    inline void LoadField(State* s, int index, std::unordered_map<Ky, Vy, Hash, Eq, Alloc>& map) {
+        LoadContainerField(s, index, map);
+    }
+} // namespace internal
+
 XLUA_NAMESPACE_END
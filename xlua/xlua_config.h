@@ -4,6 +4,36 @@
 /* when contain is full, will incremental size */
 #define XLUA_CONTAINER_INCREMENTAL  4096
 
+/* lua state created by xlua use the size-class pool allocator by default
+ * small blocks are allocated from the per state free lists, large blocks pass to malloc
+ * Create(mod, true) uses the pool whatever the default is
+*/
+#ifndef XLUA_ENABLE_POOL_ALLOC
+    #define XLUA_ENABLE_POOL_ALLOC  0
+#endif
+
+/* count calls, parameter check failures and latency of every export function/variate
+ * the statistics is fetched by State::GetCallStats/DumpCallStats
+*/
+#ifndef XLUA_ENABLE_CALL_STATS
+    #define XLUA_ENABLE_CALL_STATS  0
+#endif
+
+/* compile the export functions to the compact per signature descriptor
+ * parameters are checked and reported through a shared table instead of the inlined template chain,
+ * the call body is generated once per signature and shared by the functions with the same signature.
+ * smaller binary and less i-cache pressure, but a few indirect calls on each call
+*/
+#ifndef XLUA_ENABLE_COMPACT_CALL
+    #define XLUA_ENABLE_COMPACT_CALL    0
+#endif
+
+#if defined(_MSC_VER)
+    #define _XLUA_NOINLINE  __declspec(noinline)
+#else
+    #define _XLUA_NOINLINE  __attribute__((noinline))
+#endif
+
 /* switch the multiple inheritance optimize
  * if enable this optimize then
  * 1. will directily cast the derived pointer to base pointer
@@ -1,5 +1,8 @@
 #pragma once
 #include "xlua_config.h"
+#include <stddef.h>
+#include <cstddef>
+#include <string>
 #include <type_traits>
 #include <typeinfo>
 
@@ -21,10 +24,137 @@ class ObjectIndex;
 
 /* create a state
  * mod: module name, all global export element will set under the module name
+ * pool_alloc: use the per state size-class pool allocator
 */
-State* Create(const char* mod);
+State* Create(const char* mod, bool pool_alloc = XLUA_ENABLE_POOL_ALLOC);
 State* Attach(lua_State* l, const char* mod);
 
+/* memory statistics of the state */
+struct AllocStats {
+    /* size class step, every block is aligned as malloc */
+    static constexpr size_t kClassStep = alignof(std::max_align_t) > 16 ? alignof(std::max_align_t) : 16;
+    static constexpr int kClassNum = 32;        // blocks larger than step * num pass to malloc
+
+    size_t limit = 0;               // memory limit, 0 is unlimited
+    size_t xlua = 0;                // bytes used by xlua containers, charged to the limit
+    size_t live = 0;                // live bytes
+    size_t peak = 0;                // peak live bytes
+    size_t arena = 0;               // bytes reserved by arenas
+    size_t large_count = 0;         // live large blocks
+    size_t class_count[kClassNum] = {0};    // live blocks of each size class
+};
+
+/* statistics of the frame budgeted gc stepping */
+struct GcStats {
+    size_t steps = 0;               // gc slices run by GcStep
+    size_t cycles = 0;              // gc cycles finished by GcStep
+    size_t step_kb = 0;             // current slice size in KB
+    size_t freed = 0;               // total bytes freed by GcStep
+    size_t last_freed = 0;          // bytes freed by last GcStep
+    size_t alloc_rate = 0;          // bytes allocated between last two GcStep
+    uint64_t total_us = 0;          // total time used by GcStep
+    uint64_t last_us = 0;           // time used by last GcStep
+    uint64_t max_us = 0;            // max time used by one GcStep
+    uint64_t max_slice_us = 0;      // max time used by one gc slice
+    size_t over_slices = 0;         // slices longer than the budget
+};
+
+/* call statistics of an export function/variate, need XLUA_ENABLE_CALL_STATS */
+struct CallStat {
+    static constexpr int kHistNum = 16;     // latency histogram, bucket i is less than 2^(i+7) ns
+
+    const char* type = nullptr;     // export type name
+    const char* name = nullptr;     // member name
+    uint64_t calls = 0;
+    uint64_t failed = 0;            // parameter check failed
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint32_t hist[kHistNum] = {0};
+};
+
+/* sampling lua profiler config
+ * the overhead is bounded by count, interval and the stack limits
+*/
+struct ProfilerConfig {
+    int count = 1000;               // check sample every count vm instructions
+    uint64_t interval_us = 1000;    // min time between two samples, 0 sample at every check
+    int max_depth = 64;             // deeper frames are folded to the root frame "..."
+    size_t max_stacks = 8192;       // new stacks are counted as "[other]" when full
+};
+
+/* userdata push path statistics, the hit/miss of the identity caches */
+struct PushStats {
+    uint64_t value_hit = 0;         // lua owned value object
+    uint64_t value_new = 0;
+    uint64_t lud = 0;               // pushed as light userdata
+    uint64_t lud_fallback = 0;      // light userdata pack failed, the obj index or pointer is overflow
+    uint64_t weak_hit = 0;          // weak obj cache
+    uint64_t weak_miss = 0;
+    uint64_t weak_stale = 0;        // the cached weak obj is discard
+    uint64_t ptr_hit = 0;           // declared type pointer cache
+    uint64_t ptr_miss = 0;
+    uint64_t ptr_stale = 0;         // the address is reused by other object
+    uint64_t collection_hit = 0;    // collection pointer cache
+    uint64_t collection_miss = 0;
+    uint64_t smart_hit = 0;         // smart pointer cache
+    uint64_t smart_miss = 0;
+    uint64_t derived = 0;           // cached userdata is updated to derived type
+};
+
+/* entry count of the identity caches */
+struct CacheStats {
+    size_t value_uds = 0;           // lua owned value object
+    size_t value_refs = 0;          // value object refered by pointer
+    size_t declared_ptr_uds = 0;
+    size_t collection_ptr_uds = 0;
+    size_t smart_ptr_uds = 0;
+    size_t weak_obj_uds = 0;        // cached weak obj
+    size_t weak_obj_slots = 0;      // capacity of the weak obj caches
+    size_t gc_pending = 0;          // collected userdata waiting for cache release
+};
+
+/* time used by the state creation */
+struct StartupStats {
+    uint64_t init_us = 0;           // lua state, libs and xlua tables
+    uint64_t reg_us = 0;            // const values and export types, the first state finalizes the type descs
+    uint64_t script_us = 0;         // export scripts
+    uint64_t declared_us = 0;       // type tables and metatables
+    size_t declared = 0;            // registered type count
+};
+
+/* lua heap attribution config
+ * every sample_bytes allocated by lua is attributed to the current lua source line
+*/
+struct HeapProfilerConfig {
+    size_t sample_bytes = 64 * 1024;
+    size_t max_sites = 4096;        // new sites are counted as "[other]" when full
+};
+
+/* sampled lua allocation of a source line */
+struct AllocSite {
+    const char* site = nullptr;     // "source:line", valid until the heap profiler restart
+    uint64_t samples = 0;
+    uint64_t bytes = 0;             // estimated bytes, samples * sample_bytes
+};
+
+/* userdata count of an export type, counted since the heap profiler start */
+struct UdStat {
+    enum Kind { kPtr, kSmartPtr, kValue, kKindNum };
+
+    const char* type = nullptr;
+    int64_t live[kKindNum] = {0};
+    uint64_t created[kKindNum] = {0};
+};
+
+/* deferred destruction of the value/smart pointer payload held by lua
+ * specialize as std::true_type, the payload is moved out on gc and destroyed
+ * by State::DrainDeferred or the batch of State::TakeDeferred
+ * the type must be nothrow move constructible, and must not hold lua refs if the batch is destroyed at other thread
+ * the payloads collected while the state is closing are destroyed directly
+*/
+template <typename Ty>
+struct DeferDestruct : std::false_type {};
+
 /* type identify */
 template <typename Ty>
 struct Identity { typedef Ty type; };
@@ -50,6 +180,8 @@ struct collection_category_tag : object_category_tag_ {};
 typedef int(*LuaFunction)(lua_State* l);
 /* export to lua var indexer (get/set) */
 typedef int(*LuaIndexer)(State* s, void* obj, const TypeDesc* desc);
+/* error log of the state, the message has no trailing newline */
+typedef void(*LogFunc)(const char* msg);
 
 /* type caster,
  * used for static_cast pointer to base type or dynamic_cast to derived type
@@ -112,6 +244,30 @@ struct ICollection {
     virtual int NewIndex(void* obj, State* s) = 0;
     virtual int Iter(void* obj, State* s) = 0;
     virtual int Length(void* obj) = 0;
+    /* copy the elements to a new lua table on the top stack, false if not support */
+    virtual bool ToTable(void* obj, State* s) { return false; }
+    /* replace the elements by the lua table on the index, false if not support */
+    virtual bool FromTable(void* obj, State* s, int index) { return false; }
+};
+
+/* export member of a type
+ * the export macros build a static table per type, terminated by a kNone member,
+ * the name is purified already and may be not null terminated
+*/
+struct ExportMember {
+    enum class Kind : char {
+        kNone,
+        kFunc,
+        kVar,
+    };
+
+    Kind kind;
+    bool global;
+    const char* name;
+    size_t len;
+    LuaFunction func;
+    LuaIndexer getter;
+    LuaIndexer setter;
 };
 
 /* type desc factory */
@@ -121,7 +277,10 @@ struct ITypeFactory {
     virtual void SetWeakProc(WeakObjProc proc) = 0;
     virtual void AddMember(bool global, const char* name, LuaFunction func) = 0;
     virtual void AddMember(bool global, const char* name, LuaIndexer getter, LuaIndexer setter) = 0;
+    /* finalize with the added members */
     virtual const TypeDesc* Finalize() = 0;
+    /* finalize with the static member table, the table is refered directly */
+    virtual const TypeDesc* Finalize(const ExportMember* members) = 0;
 };
 
 /* cast obj type to super type */
@@ -170,6 +329,52 @@ private:
     int index_ = 0;
 };
 
+namespace internal {
+    int InternKeyId(const char* str, size_t len);
+}
+
+/* interned string key of the field apis
+ * the lua string is created once for each state and pinned in the registry,
+ * later push is a single lua_rawgeti. the keys with same string share the id,
+ * construction looks up the global intern table, define the key as static for speed
+*/
+class Key {
+public:
+    explicit Key(const char* str) : str_(str), id_(internal::InternKeyId(str_.c_str(), str_.size())) {}
+    Key(const char* str, size_t len) : str_(str, len), id_(internal::InternKeyId(str_.c_str(), str_.size())) {}
+
+    Key(const Key&) = delete;
+    Key& operator = (const Key&) = delete;
+
+public:
+    inline const char* GetStr() const { return str_.c_str(); }
+    inline size_t GetLen() const { return str_.size(); }
+    inline int GetId() const { return id_; }
+
+private:
+    std::string str_;
+    int id_;
+};
+
+/* field of a struct converted to/from lua table by value
+ * load is called with the field value on the top of stack
+*/
+struct StructField {
+    typedef void (*PushProc)(State* s, const void* obj);
+    typedef void (*LoadProc)(State* s, void* obj);
+
+    const Key* key;
+    PushProc push;
+    LoadProc load;
+};
+
+/* declared struct desc, the fields table is terminated by a null key field */
+struct StructDesc {
+    const char* name;
+    const StructField* fields;
+    int field_num;
+};
+
 namespace internal {
     template <typename Ty>
     struct PurifyType_ {
@@ -208,6 +413,16 @@ public:
     static constexpr bool value = decltype(Check<typename std::decay<Ty>::type>(0))::value;
 };
 
+/* check the type is declared to convert with lua table */
+template <typename Ty>
+struct IsLuaStruct {
+private:
+    template <typename U> static auto Check(int)->decltype(xLuaGetStructDesc(Identity<U>()), std::true_type());
+    template <typename U> static auto Check(...)->std::false_type;
+public:
+    static constexpr bool value = decltype(Check<typename std::decay<Ty>::type>(0))::value;
+};
+
 /* traits type is support xlua weak object reference */
 template<typename Ty>
 struct IsWeakObj {
@@ -236,7 +451,7 @@ struct WeakObjTraits {
 private:
     /* detect the class dealcre the xlua_obj_index_ member var */
     template <typename C> static C* Query(xlua::ObjectIndex C::*) { return nullptr; }
-    typedef typename decltype(Query(&Ty::xlua_obj_index_)) class_type_ptr;
+    typedef decltype(Query(&Ty::xlua_obj_index_)) class_type_ptr;
 
     static WeakObjRef Make(void* obj) {
         return internal::MakeWeakObjRef(static_cast<class_type_ptr>(obj), static_cast<Ty*>(obj)->xlua_obj_index_);
@@ -284,6 +499,7 @@ struct ObjectWrapper<void> {
 };
 
 namespace internal {
+    /* find the state of the lua thread, the running thread of the state is not changed */
     State* GetState(lua_State* l);
     void Destory(State* l);
 }
@@ -326,3 +542,7 @@ inline const XLUA_NAMESPACE WeakObjProc xLuaQueryWeakObjProc(XLUA_NAMESPACE Iden
 /* declare export type to lua */
 #define XLUA_DECLARE_CLASS(ClassName)   \
     const XLUA_NAMESPACE TypeDesc* xLuaGetTypeDesc(XLUA_NAMESPACE Identity<ClassName>)
+
+/* declare struct convert to/from lua table by value */
+#define XLUA_DECLARE_STRUCT(StructName) \
+    const XLUA_NAMESPACE StructDesc* xLuaGetStructDesc(XLUA_NAMESPACE Identity<StructName>)
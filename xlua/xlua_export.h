@@ -147,11 +147,45 @@ namespace internal {
         static void* ToDerived(void* obj) { return obj; }
     };
 
+#if XLUA_ENABLE_COMPACT_CALL
+    _XLUA_NOINLINE inline bool CheckMetaVar(State* s, int index, const TypeDesc* desc, StringView name, const CallDesc& call) {
+        if (CheckParameters(s, index, call))
+            return true;
+
+        s->state_.OnCallFailed();
+        char buff[1024];
+        luaL_error(s->GetLuaState(), "attemp to set var [%s.%s] failed, paramenter is not accpeted,\nparams{%s}",
+            desc->name, StringCache<>(name).Str(), GetParameterNames(buff, 1024, s, index, call));
+        return false;
+    }
+
+    template <typename Ty>
+    inline bool CheckMetaVar(State* s, int index, const TypeDesc* desc, StringView name) {
+        return CheckMetaVar(s, index, desc, name, CallDescOf<Ty>::value);
+    }
+
+    _XLUA_NOINLINE inline bool CheckMetaParameters(State* s, int index, const TypeDesc* desc, StringView name, const CallDesc& call) {
+        if (CheckParameters(s, index, call))
+            return true;
+
+        s->state_.OnCallFailed();
+        char buff[1024];
+        luaL_error(s->GetLuaState(), "attemp to call fcuntion [%s.%s] failed, paramenter is not accpeted,\nparams{%s}",
+            desc->name, StringCache<>(name).Str(), GetParameterNames(buff, 1024, s, index, call));
+        return false;
+    }
+
+    template <typename... Args>
+    inline bool CheckMetaParameters(State* s, int index, const TypeDesc* desc, StringView name) {
+        return CheckMetaParameters(s, index, desc, name, CallDescOf<Args...>::value);
+    }
+#else
     template <typename Ty>
     bool CheckMetaVar(State* s, int index, const TypeDesc* desc, StringView name) {
         if (DoCheckParam<Ty>(s, index))
             return true;
 
+        s->state_.OnCallFailed();
         char buff[1024];
         luaL_error(s->GetLuaState(), "attemp to set var [%s.%s] failed, paramenter is not accpeted,\nparams{%s}",
             desc->name, StringCache<>(name).Str(), GetParameterNames<Ty>(buff, 1024, s, index));
@@ -163,11 +197,13 @@ namespace internal {
         if (CheckParameters<Args...>(s, index))
             return true;
 
+        s->state_.OnCallFailed();
         char buff[1024];
         luaL_error(s->GetLuaState(), "attemp to call fcuntion [%s.%s] failed, paramenter is not accpeted,\nparams{%s}",
             desc->name, StringCache<>(name).Str(), GetParameterNames<Args...>(buff, 1024, s, index));
         return false;
     }
+#endif // XLUA_ENABLE_COMPACT_CALL
 
     /* set array value, only support string */
     inline void MetaSetArray(State* s, char* buf, size_t sz) {
@@ -292,29 +328,29 @@ namespace internal {
 
     template <typename Ty>
     inline void MetaGet(State* s, Ty* obj, int(Ty::*func)(lua_State*)) {
-        (obj->*func)(s->GetState());
+        (obj->*func)(s->GetLuaState());
     }
 
     template <typename Ty>
     inline void MetaGet(State* s, Ty* obj, int(Ty::*func)(lua_State*) const) {
-        (obj->*func)(s->GetState());
+        (obj->*func)(s->GetLuaState());
     }
 
     template <typename Ty>
     inline void MetaSet(State* s, Ty* obj, const TypeDesc* desc, StringView name, int(Ty::*func)(lua_State*)) {
-        (obj->*func)(s->GetState());
+        (obj->*func)(s->GetLuaState());
     }
 
     template <typename Ty>
     inline void MetaSet(State* s, Ty* obj, const TypeDesc* desc, StringView name, void(Ty::*func)(lua_State*)) {
-        (obj->*func)(s->GetState());
+        (obj->*func)(s->GetLuaState());
     }
 
     template <typename Ty, class Cy, typename Ry, typename... Args, size_t... Idxs>
     inline int MetaCall(State* s, Ty* obj, const TypeDesc* desc, StringView name, Ry(Cy::*func)(Args...), index_sequence<Idxs...>) {
         if (CheckMetaParameters<Args...>(s, 2, desc, name)) {
-            PushRetVal<Ry>(s, (obj->*func)(SupportTraits<Args>::supporter::Load(s, 2 + Idxs)...));
-            return 1;
+            int ret = PushRet<Ry>(s, (obj->*func)(SupportTraits<Args>::supporter::Load(s, 2 + Idxs)...));
+            return ReturnOrYield(s, ret);
         }
         return 0;
     }
@@ -327,8 +363,8 @@ namespace internal {
     template <typename Ty, class Cy, typename Ry, typename... Args, size_t... Idxs>
     inline int MetaCall(State* s, Ty* obj, const TypeDesc* desc, StringView name, Ry(Cy::*func)(Args...)const, index_sequence<Idxs...>) {
         if (CheckMetaParameters<Args...>(s, 2, desc, name)) {
-            PushRetVal<Ry>(s, (obj->*func)(SupportTraits<Args>::supporter::Load(s, 2 + Idxs)...));
-            return 1;
+            int ret = PushRet<Ry>(s, (obj->*func)(SupportTraits<Args>::supporter::Load(s, 2 + Idxs)...));
+            return ReturnOrYield(s, ret);
         }
         return 0;
     }
@@ -409,8 +445,8 @@ namespace internal {
     template <typename Ry, typename... Args, size_t... Idxs>
     inline int MetaCall(State* s, const TypeDesc* desc, StringView name, Ry(*func)(Args...), index_sequence<Idxs...>) {
         if (CheckMetaParameters<Args...>(s, 1, desc, name)) {
-            PushRetVal<Ry>(s, func(SupportTraits<Args>::supporter::Load(s, 1 + Idxs)...));
-            return 1;
+            int ret = PushRet<Ry>(s, func(SupportTraits<Args>::supporter::Load(s, 1 + Idxs)...));
+            return ReturnOrYield(s, ret);
         }
         return 0;
     }
@@ -491,10 +527,29 @@ namespace internal {
             return 0;
         }
 
-        template <typename Fy, typename std::enable_if<std::is_member_function_pointer<Fy>::value, int>::type = 0>
+#if XLUA_ENABLE_COMPACT_CALL
+        /* the call body is shared by the functions with the same signature */
+        template <typename Fy>
+        static inline int Call(State* s, const TypeDesc* desc, StringView name, Fy f) {
+            return CompactCall<Fy>(s, desc, name, f);
+        }
+
+        template <typename Fy>
+        _XLUA_NOINLINE static int CompactCall(State* s, const TypeDesc* desc, StringView name, Fy f) {
+            return DoCall(s, desc, name, f);
+        }
+#else
+        template <typename Fy>
         static inline int Call(State* s, const TypeDesc* desc, StringView name, Fy f) {
+            return DoCall(s, desc, name, f);
+        }
+#endif // XLUA_ENABLE_COMPACT_CALL
+
+        template <typename Fy, typename std::enable_if<std::is_member_function_pointer<Fy>::value, int>::type = 0>
+        static inline int DoCall(State* s, const TypeDesc* desc, StringView name, Fy f) {
             Ty* obj = s->Get<Ty*>(1);
             if (obj == nullptr) {
+                s->state_.OnCallFailed();
                 luaL_error(s->GetLuaState(), "attempt call function [%s.%s] failed, obj is nil", desc->name, StringCache<>(name).Str());
                 return 0;
             }
@@ -503,7 +558,7 @@ namespace internal {
         }
 
         template <typename Fy, typename std::enable_if<!std::is_member_function_pointer<Fy>::value, int>::type = 0>
-        static inline int Call(State* s, const TypeDesc* desc, StringView name, Fy f) {
+        static inline int DoCall(State* s, const TypeDesc* desc, StringView name, Fy f) {
             return MetaCall(s, desc, name, f);
         }
     };
@@ -512,6 +567,9 @@ namespace internal {
     template <> struct BaseType<> { typedef void type; };
     template <typename Ty> struct BaseType<Ty> { typedef Ty type; };
 
+    template<class Ty>
+    struct is_null_pointer : std::is_same<std::nullptr_t, typename std::remove_cv<Ty>::type> {};
+
     template <typename GetTy, typename SetTy>
     struct IndexerTrait {
     private:
@@ -667,10 +725,16 @@ namespace internal {
         }
     };
 
-    template<class Ty>
-    struct is_null_pointer : std::is_same<std::nullptr_t, typename std::remove_cv<Ty>::type> {};
-
     ITypeFactory* CreateFactory(bool global, const char* path, const TypeDesc* super);
+
+    /* member table element */
+    inline ExportMember MakeMember(bool global, StringView name, LuaFunction func) {
+        return ExportMember{ExportMember::Kind::kFunc, global, name.str, name.len, func, nullptr, nullptr};
+    }
+
+    inline ExportMember MakeMember(bool global, StringView name, LuaIndexer getter, LuaIndexer setter) {
+        return ExportMember{ExportMember::Kind::kVar, global, name.str, name.len, nullptr, getter, setter};
+    }
 } // namespace internal
 
 /* create global module factory */
@@ -704,34 +768,53 @@ XLUA_NAMESPACE_END
 #define _XLUA_EXTRACT_METHOD(Func, ...)     xlua::internal::Extractor<__VA_ARGS__>::extract(xlua::internal::conv_const_tag(), Func)
 
 // ʵ
+#if XLUA_ENABLE_CALL_STATS
+    #define _XLUA_CALL_STAT_BEGIN(S, Name, Op)                                                  \
+        static const int stat_id = xlua::internal::RegisterCallStat(desc,                       \
+            xlua::internal::PurifyMemberName(#Name), Op);                                       \
+        xlua::internal::CallMark stat_mark = (S)->state_.BeginCall(stat_id);
+    #define _XLUA_CALL_STAT_END(S)          (S)->state_.EndCall(stat_mark);
+#else
+    #define _XLUA_CALL_STAT_BEGIN(S, Name, Op)
+    #define _XLUA_CALL_STAT_END(S)
+#endif // XLUA_ENABLE_CALL_STATS
+
 #define _XLUA_EXPORT_FUNC_(Name, Func, IsGlobal)                                                \
-    factory->AddMember(IsGlobal, #Name, [](lua_State* l)->int {                                 \
+    xlua::internal::MakeMember(IsGlobal, xlua::internal::PurifyMemberName(#Name),               \
+        [](lua_State* l)->int {                                                                 \
         static_assert(!xlua::internal::is_null_pointer<decltype(Func)>::value,                  \
             "can not export func:"#Name" with null pointer");                                   \
         constexpr xlua::internal::StringView name = xlua::internal::PurifyMemberName(#Name);    \
-        return meta::Call(xlua::internal::GetState(l), desc, name, Func);                       \
-    });
+        xlua::State* s = xlua::internal::GetState(l);                                           \
+        _XLUA_CALL_STAT_BEGIN(s, Name, "")                                                      \
+        int ret = meta::Call(s, desc, name, Func);                                              \
+        _XLUA_CALL_STAT_END(s)                                                                  \
+        return ret;                                                                             \
+    }),
 
 #define _XLUA_EXPORT_FUNC(Name, Func)       \
     _XLUA_EXPORT_FUNC_(Name, Func, !std::is_member_function_pointer<decltype(Func)>::value)
 
 #define _XLUA_EXPORT_VAR_(Name, GetOp, SetOp, IsGlobal)                                         \
-    static_assert(is_g_table == false, "_G table not support export variate");                  \
-    static_assert(xlua::internal::IndexerTrait<decltype(GetOp), decltype(SetOp)>::is_allow,     \
-        "can not export var:"#Name" to lua" );                                                  \
-    struct _XLUA_ANONYMOUS {                                                                    \
-        static int Get(xlua::State* s, void* obj, const xlua::TypeDesc* src) {                  \
-            return meta::Get(s, obj, src, desc, GetOp);                                         \
-        }                                                                                       \
-        static int Set(xlua::State* s, void* obj, const xlua::TypeDesc* src) {                  \
+    xlua::internal::MakeMember(IsGlobal, xlua::internal::PurifyMemberName(#Name),               \
+        xlua::internal::is_null_pointer<decltype(GetOp)>::value ? nullptr : (xlua::LuaIndexer)  \
+        [](xlua::State* s, void* obj, const xlua::TypeDesc* src)->int {                         \
+            static_assert(is_g_table == false, "_G table not support export variate");          \
+            static_assert(xlua::internal::IndexerTrait<decltype(GetOp), decltype(SetOp)>::is_allow,\
+                "can not export var:"#Name" to lua" );                                          \
+            _XLUA_CALL_STAT_BEGIN(s, Name, ".get")                                              \
+            int ret = meta::Get(s, obj, src, desc, GetOp);                                      \
+            _XLUA_CALL_STAT_END(s)                                                              \
+            return ret;                                                                         \
+        },                                                                                      \
+        xlua::internal::is_null_pointer<decltype(SetOp)>::value ? nullptr : (xlua::LuaIndexer)  \
+        [](xlua::State* s, void* obj, const xlua::TypeDesc* src)->int {                         \
             constexpr xlua::internal::StringView name = xlua::internal::PurifyMemberName(#Name);\
-            return meta::Set(s, obj, src, desc, name, SetOp);                                   \
-        }                                                                                       \
-    };                                                                                          \
-    factory->AddMember(IsGlobal, #Name,                                                         \
-        xlua::internal::is_null_pointer<decltype(GetOp)>::value ? nullptr : &_XLUA_ANONYMOUS::Get,\
-        xlua::internal::is_null_pointer<decltype(SetOp)>::value ? nullptr : &_XLUA_ANONYMOUS::Set \
-    );
+            _XLUA_CALL_STAT_BEGIN(s, Name, ".set")                                              \
+            int ret = meta::Set(s, obj, src, desc, name, SetOp);                                \
+            _XLUA_CALL_STAT_END(s)                                                              \
+            return ret;                                                                         \
+        }),
 
 #define _XLUA_IS_STATIC_VAR(GetOp, SetOp)               \
     !xlua::internal::IndexerTrait<decltype(GetOp), decltype(SetOp)>::is_member
@@ -757,11 +840,14 @@ XLUA_NAMESPACE_END
             using meta = xlua::internal::Meta<ClassName>;                               \
             constexpr bool is_g_table = false;                                          \
             auto* factory = xlua::CreateFactory<                                        \
-                ClassName, _XLUA_SUPER_CLASS(__VA_ARGS__)>(#ClassName);
+                ClassName, _XLUA_SUPER_CLASS(__VA_ARGS__)>(#ClassName);                 \
+            static const xlua::ExportMember members[] = {
 
 /* lua */
 #define XLUA_EXPORT_CLASS_END()                                                         \
-            return factory->Finalize();                                                 \
+                xlua::ExportMember{}                                                    \
+            };                                                                          \
+            return factory->Finalize(members);                                          \
         }();                                                                            \
         return desc;                                                                    \
     }                                                                                   \
@@ -774,9 +860,12 @@ XLUA_NAMESPACE_END
                 using meta = xlua::internal::Meta<void>;                                \
                 constexpr bool is_g_table = xlua::internal::Is_G(#Name);                \
                 auto* factory = xlua::CreateFactory<void>(#Name);                       \
+                static const xlua::ExportMember members[] = {
 
 #define XLUA_EXPORT_GLOBAL_END()                                                        \
-                return factory->Finalize();                                             \
+                    xlua::ExportMember{}                                                \
+                };                                                                      \
+                return factory->Finalize(members);                                      \
             }();                                                                        \
         });                                                                             \
     }
@@ -793,6 +882,42 @@ XLUA_NAMESPACE_END
 #define XLUA_VARIATE_WRAP(Name, Get, Set)   _XLUA_EXPORT_VAR(Name, &Get, &Set)
 #define XLUA_VARIATE_WRAP_R(Name, Get)      _XLUA_EXPORT_VAR(Name, &Get, nullptr)
 
+#define _XLUA_EXPORT_FIELD(Name, Var)                                                   \
+    xlua::StructField{                                                                  \
+        []() -> const xlua::Key* {                                                      \
+            constexpr xlua::internal::StringView name = xlua::internal::PurifyMemberName(#Name);\
+            static const xlua::Key key(name.str, name.len);                             \
+            return &key;                                                                \
+        }(),                                                                            \
+        [](xlua::State* s, const void* obj) {                                           \
+            xlua::internal::PushField(s, static_cast<const struct_type*>(obj)->*(&Var));\
+        },                                                                              \
+        [](xlua::State* s, void* obj) {                                                 \
+            xlua::internal::LoadField(s, -1, static_cast<struct_type*>(obj)->*(&Var));  \
+        }},
+
+/* export struct, convert with lua table by value
+ * push creates the table presized, fields are set/get with the interned keys,
+ * missing fields keep the default value and unknown keys are ignored
+*/
+#define XLUA_EXPORT_STRUCT_BEGIN(StructName)                                            \
+    const xlua::StructDesc* xLuaGetStructDesc(xlua::Identity<StructName>) {             \
+        using struct_type = StructName;                                                 \
+        constexpr const char* struct_name = #StructName;                                \
+        static const xlua::StructField fields[] = {
+
+#define XLUA_EXPORT_STRUCT_END()                                                        \
+            xlua::StructField{}                                                         \
+        };                                                                              \
+        static const xlua::StructDesc desc{struct_name, fields,                         \
+            (int)(sizeof(fields) / sizeof(fields[0])) - 1};                             \
+        return &desc;                                                                   \
+    }
+
+/* export struct field */
+#define XLUA_FIELD(Var)                     _XLUA_EXPORT_FIELD(Var, Var)
+#define XLUA_FIELD_AS(Name, Var)            _XLUA_EXPORT_FIELD(Name, Var)
+
 /*  */
 #define XLUA_EXPORT_CONSTANT_BEGIN(Name)                                                \
     namespace {                                                                         \
@@ -19,6 +19,8 @@ enum class VarType : int8_t {
     kUserData,
 };
 
+class Variant;
+
 /* lua stack guarder */
 class StackGuard {
 public:
@@ -52,16 +54,20 @@ public:
     CallGuard() : StackGuard() {}
     CallGuard(lua_State* l, int off = 0) : StackGuard(l, off) {}
     CallGuard(State* s, int off = 0) : StackGuard(s, off) {}
-    CallGuard(CallGuard&& other) : StackGuard(std::move(other)), ok_(other.ok_) {}
+    CallGuard(CallGuard&& other) : StackGuard(std::move(other)), ok_(other.ok_), status_(other.status_) {}
 
     CallGuard(const CallGuard&) = delete;
     void operator = (const CallGuard&) = delete;
 
 public:
     explicit inline operator bool() const { return ok_; }
+    /* lua status code of the call */
+    inline int GetStatus() const { return status_; }
+    inline bool IsOutOfMemory() const { return status_ == LUA_ERRMEM; }
 
 protected:
     bool ok_ = false;
+    int status_ = LUA_OK;
 };
 inline bool operator == (const CallGuard& g, bool b) { return (bool)g == b; }
 inline bool operator == (bool b, const CallGuard& g) { return (bool)g == b; }
@@ -80,6 +86,73 @@ public:
 #define XCALL_SUCC(Call) if (xlua::CallGuard guard = Call)
 #define XCALL_FAIL(Call) if (xlua::FailedCall guard = Call)
 
+/* payloads of the lua gc objects waiting for destruction
+ * can be moved to other thread and destroyed there
+*/
+class DeferredBatch {
+public:
+    DeferredBatch() = default;
+    DeferredBatch(std::vector<internal::IObjData*>&& objs) : objs_(std::move(objs)) {}
+    DeferredBatch(DeferredBatch&& other) : objs_(std::move(other.objs_)) {}
+    ~DeferredBatch() { Clear(); }
+
+    DeferredBatch(const DeferredBatch&) = delete;
+    void operator = (const DeferredBatch&) = delete;
+
+public:
+    inline size_t Size() const { return objs_.size(); }
+    inline void Clear() {
+        for (auto* obj : objs_)
+            delete obj;
+        objs_.clear();
+    }
+
+private:
+    std::vector<internal::IObjData*> objs_;
+};
+
+/* table traversal cursor
+ * the key and value stay on the stack while the callback runs, load them in place,
+ * nothing is copied or referenced unless the loaded type does.
+ * a number key loaded as not number type is loaded from a copy, lua_tolstring converts it in place
+*/
+class TableCursor {
+public:
+    TableCursor(State* s, int key) : s_(s), key_(key) {}
+
+public:
+    inline State* GetState() const { return s_; }
+    inline int GetKeyIndex() const { return key_; }
+    inline int GetValueIndex() const { return key_ + 1; }
+    inline VarType GetKeyType() const;
+    inline VarType GetValueType() const;
+
+    template <typename Ty>
+    inline auto GetKey() const -> typename SupportTraits<Ty>::value_type;
+    template <typename Ty>
+    inline auto GetValue() const -> typename SupportTraits<Ty>::value_type;
+
+private:
+    State* s_;
+    int key_;
+};
+
+namespace internal {
+    /* the traversal callback returns void or false to stop */
+    template <typename Fn, typename... Args>
+    inline auto VisitField(Fn& fn, Args&&... args) -> typename std::enable_if<
+            std::is_void<decltype(fn(std::forward<Args>(args)...))>::value, bool>::type {
+        fn(std::forward<Args>(args)...);
+        return true;
+    }
+
+    template <typename Fn, typename... Args>
+    inline auto VisitField(Fn& fn, Args&&... args) -> typename std::enable_if<
+            !std::is_void<decltype(fn(std::forward<Args>(args)...))>::value, bool>::type {
+        return (bool)fn(std::forward<Args>(args)...);
+    }
+} // namespace internal
+
 /* xlua state
  * the main interface of xlua
 */
@@ -101,7 +174,98 @@ public:
     inline bool IsNil(int index) { return lua_isnil(state_.l_, index); }
     inline void PushNil() { lua_pushnil(state_.l_); }
     inline void NewTable() { lua_newtable(state_.l_); }
-    inline void Gc() { lua_gc(state_.l_, LUA_GCCOLLECT, 0); }
+    inline void Gc() {
+        lua_gc(state_.l_, LUA_GCCOLLECT, 0);
+        state_.CheckFlushGc();
+    }
+    /* run incremental gc slices until the budget(microseconds) is used, return true if a gc cycle finished
+     * one slice is sized to about 1/4 budget by the measured cost, the atomic phase of lua gc can not be split
+    */
+    inline bool GcStep(uint64_t budget_us) { return internal::GcStep(this, budget_us); }
+    /* stop the lua incremental collector, gc is driven only by GcStep and Gc */
+    inline void SetGcAuto(bool enable) { internal::SetGcAuto(this, enable); }
+    /* set gc pause/stepmul, return the previous value */
+    inline int SetGcPause(int pause) {
+        state_.gc_.pause = pause;
+        return lua_gc(state_.l_, LUA_GCSETPAUSE, pause);
+    }
+    inline int SetGcStepMul(int mul) { return lua_gc(state_.l_, LUA_GCSETSTEPMUL, mul); }
+    inline const GcStats& GetGcStats() const { return state_.gc_.stats; }
+    /* start the sampling lua profiler, the samples of last run are discarded
+     * the hook counts vm instructions, the time of exported c++ calls is sampled in the calling lua frame
+     * the coroutines created before start are hooked when they are resumed
+    */
+    inline bool StartProfiler(const ProfilerConfig& config = ProfilerConfig()) { return internal::StartProfiler(this, config); }
+    inline void StopProfiler() { internal::StopProfiler(this); }
+    inline uint64_t GetProfileSamples() const { return internal::GetProfileSamples(this); }
+    /* write the sampled stacks as folded stacks, the input format of flamegraph.pl */
+    inline bool WriteProfile(const char* file) const { return internal::WriteProfile(this, file); }
+    /* userdata push path statistics */
+    inline const PushStats& GetPushStats() const { return state_.push_stats_; }
+    inline void ResetPushStats() { state_.push_stats_ = PushStats(); }
+    /* start the lua heap attribution and the userdata count, the result of last run is discarded */
+    inline bool StartHeapProfiler(const HeapProfilerConfig& config = HeapProfilerConfig()) { return internal::StartHeapProfiler(this, config); }
+    inline void StopHeapProfiler() { internal::StopHeapProfiler(this); }
+    /* sampled allocation sites, sorted by bytes */
+    inline std::vector<AllocSite> GetAllocSites() const { return internal::GetAllocSites(this); }
+    /* userdata count by export type, sorted by live count */
+    inline std::vector<UdStat> GetUdStats() const { return internal::GetUdStats(this); }
+    inline std::string DumpHeapProfile() const { return internal::DumpHeapProfile(this); }
+    /* entry count of the userdata identity caches */
+    inline CacheStats GetCacheStats() const { return internal::GetCacheStats(this); }
+    /* time used by Create/Attach */
+    inline const StartupStats& GetStartupStats() const { return state_.startup_; }
+    /* export member call statistics, sorted by total time, need XLUA_ENABLE_CALL_STATS */
+    inline std::vector<CallStat> GetCallStats() const { return internal::GetCallStats(this); }
+    inline void ResetCallStats() {
+        for (auto& stat : state_.call_stats_)
+            stat = CallStat();
+    }
+    /* dump the call statistics as text table or csv */
+    inline std::string DumpCallStats(bool csv = false) const { return internal::DumpCallStats(this, csv); }
+    /* defer the destruction of all value/smart pointer payloads, otherwise only the DeferDestruct types */
+    inline void SetDeferDestruct(bool all) { state_.defer_all_ = all; }
+    inline size_t GetDeferredCount() const { return state_.deferred_.size(); }
+    /* destroy the deferred payloads at this safe point, max 0 is all, return the destroyed count */
+    inline size_t DrainDeferred(size_t max = 0) {
+        auto& deferred = state_.deferred_;
+        size_t count = (max == 0 || max > deferred.size()) ? deferred.size() : max;
+        for (size_t i = 0; i < count; ++i) {
+            delete deferred.back();
+            deferred.pop_back();
+        }
+        return count;
+    }
+    /* take all deferred payloads out, destroy them at any thread
+     * the payload destroyed out of the lua thread must not hold lua refs (Object, Table, Function, Variant)
+    */
+    inline DeferredBatch TakeDeferred() {
+        std::vector<internal::IObjData*> objs;
+        objs.swap(state_.deferred_);
+        return DeferredBatch(std::move(objs));
+    }
+    /* resume the due coroutines of scheduler, now is the time in milliseconds */
+    inline void Tick(uint64_t now) { internal::TickScheduler(this, now); }
+    /* wake up the coroutines waiting for the signal at next tick */
+    inline void Signal(int64_t id) { state_.scheduler_.Signal(id); }
+    /* statistics of the pool allocator, all zero if the state not use it */
+    inline AllocStats GetAllocStats() const { return internal::GetAllocStats(state_.alloc_, state_.budget_); }
+    /* limit the memory of lua heap and xlua containers, 0 is unlimited, need the pool allocator
+     * the limit is enforced inside Call/DoString/chunk loading and the coroutines resumed by xlua,
+     * the allocations out of them (Push, NewTable, SetField...) are charged but never refused
+    */
+    inline bool SetMemoryLimit(size_t limit) {
+        if (state_.alloc_ == nullptr)
+            return false;
+        state_.budget_.limit = limit;
+        return true;
+    }
+    /* set the error log function, null is printf, return the previous one */
+    inline LogFunc SetLogFunc(LogFunc log) {
+        LogFunc prev = state_.log_;
+        state_.log_ = log;
+        return prev;
+    }
     const char* GetTypeName(int index) const { return state_.GetTypeName(index); }
 
     template <typename... Tys>
@@ -137,12 +301,7 @@ public:
     }
 
     inline bool LoadString(const char* script, const char* chunk) {
-        int ret = luaL_loadbuffer(state_.l_, script, std::char_traits<char>::length(script), chunk);
-        if (LUA_OK != ret) {
-            printf("load chunk faile:%s\n", lua_tostring(state_.l_, -1));
-            return false;
-        }
-        return true;
+        return LoadChunk(script, chunk) == LUA_OK;
     }
 
     inline bool DoString(const char* script, const char* chunk) {
@@ -151,8 +310,12 @@ public:
 
     template <typename... Rtys, typename... Args>
     inline CallGuard DoString(const char* script, const char* chunk, std::tuple<Rtys&...>&& rets, Args&&... args) {
-        if (!LoadString(script, chunk))
-            return CallGuard(this, -1);
+        int status = LoadChunk(script, chunk);
+        if (status != LUA_OK) {
+            CallGuard guard(this, -1);
+            guard.status_ = status;
+            return guard;
+        }
         return Call(std::move(rets), std::forward<Args>(args)...);
     }
 
@@ -231,6 +394,34 @@ public:
         return Get<Ty>(-1);
     }
 
+    /* traverse the table by lua_next, fn(const TableCursor&) */
+    template <typename Fn>
+    inline bool ForEach(int index, Fn&& fn) {
+        if (lua_type(state_.l_, index) != LUA_TTABLE)
+            return false;
+
+        StackGuard guard(this);
+        index = lua_absindex(state_.l_, index);
+        lua_pushnil(state_.l_);
+        int key = GetTop();
+        TableCursor cursor(this, key);
+        while (lua_next(state_.l_, index)) {
+            bool next = internal::VisitField(fn, static_cast<const TableCursor&>(cursor));
+            lua_settop(state_.l_, key);
+            if (!next)
+                break;
+        }
+        return true;
+    }
+
+    /* traverse the table by lua_next, fn(Ky key, Vy value) */
+    template <typename Ky, typename Vy, typename Fn>
+    inline bool ForEach(int index, Fn&& fn) {
+        return ForEach(index, [&fn](const TableCursor& cursor) {
+            return internal::VisitField(fn, cursor.GetKey<Ky>(), cursor.GetValue<Vy>());
+        });
+    }
+
     template <typename Ty>
     inline auto Get(int index) -> typename SupportTraits<Ty>::value_type {
         using traits = SupportTraits<Ty>;
@@ -240,6 +431,11 @@ public:
         return supporter::Load(this, index);
     }
 
+    /* load variant, the long string refers the lua string instead of copy if ref_str
+     * such string variant is tied to this state, it could not outlive the state
+    */
+    inline Variant GetVariant(int index, bool ref_str);
+
     template <typename Ty>
     inline void Push(Ty&& val) {
         using traits = SupportTraits<Ty>;
@@ -248,6 +444,23 @@ public:
         supporter::Push(this, std::forward<Ty>(val));
     }
 
+    /* push the elements as a presized lua sequence in one pass */
+    template <typename Ty>
+    inline void PushArray(const Ty* data, size_t count) {
+        luaL_checkstack(state_.l_, 2, nullptr);
+        lua_createtable(state_.l_, (int)count, 0);
+        for (size_t i = 0; i < count; ++i) {
+            Push(data[i]);
+            lua_rawseti(state_.l_, -2, (lua_Integer)i + 1);
+        }
+    }
+
+    /* contiguous container, as std::vector, std::array */
+    template <typename Container>
+    inline void PushArray(const Container& container) {
+        PushArray(container.data(), container.size());
+    }
+
     template <typename Fy>
     inline void PushLambda(Fy&& f) {
         using type = typename PurifyType<Fy>::type;
@@ -287,17 +500,38 @@ public:
         CallGuard guard(this, -1);
 
         PushMul(std::forward<Args>(args)...);
-        if (lua_pcall(state_.l_, sizeof...(Args), sizeof...(Rys), 0) == LUA_OK) {
+        lua_State* l = state_.l_;
+        int protect = state_.budget_.protect++;
+        int status = lua_pcall(l, sizeof...(Args), sizeof...(Rys), 0);
+        state_.budget_.protect = protect;
+        state_.l_ = l;      // lua may switch the running thread to coroutine
+        guard.status_ = status;
+        if (status == LUA_OK) {
             GetMul(top, std::move(ret));
             guard.ok_ = true;
+        } else if (status == LUA_ERRMEM) {
+            internal::Log(this, "call failed: out of memory, limit:%zu", state_.budget_.limit);
         } else {
             char stack[1024];
             GetCallStack(stack, 1024);
-            printf("call failed: %s\n%s\n", lua_tostring(state_.l_, -1), stack);
+            internal::Log(this, "call failed: %s\n%s", lua_tostring(state_.l_, -1), stack);
         }
         return guard;
     }
 
+private:
+    inline int LoadChunk(const char* script, const char* chunk) {
+        int protect = state_.budget_.protect++;
+        int ret = luaL_loadbuffer(state_.l_, script, std::char_traits<char>::length(script), chunk);
+        state_.budget_.protect = protect;
+        if (ret == LUA_ERRMEM)
+            internal::Log(this, "load chunk failed: out of memory, limit:%zu", state_.budget_.limit);
+        else if (LUA_OK != ret)
+            internal::Log(this, "load chunk faile:%s", lua_tostring(state_.l_, -1));
+        return ret;
+    }
+
+public:
     internal::StateData state_;
 }; // class State
 
@@ -305,6 +539,26 @@ public:
 inline StackGuard::StackGuard(State* s, int off/* = 0*/)
     : l_(s->GetLuaState()) { Init(off); }
 
+/* table cursor */
+inline VarType TableCursor::GetKeyType() const { return s_->GetType(key_); }
+inline VarType TableCursor::GetValueType() const { return s_->GetType(key_ + 1); }
+
+template <typename Ty>
+inline auto TableCursor::GetKey() const -> typename SupportTraits<Ty>::value_type {
+    if (!std::is_arithmetic<typename SupportTraits<Ty>::value_type>::value && lua_type(s_->GetLuaState(), key_) == LUA_TNUMBER) {
+        /* the copy stays on the stack until the callback returns */
+        luaL_checkstack(s_->GetLuaState(), 1, nullptr);
+        lua_pushvalue(s_->GetLuaState(), key_);
+        return s_->Get<Ty>(-1);
+    }
+    return s_->Get<Ty>(key_);
+}
+
+template <typename Ty>
+inline auto TableCursor::GetValue() const -> typename SupportTraits<Ty>::value_type {
+    return s_->Get<Ty>(key_ + 1);
+}
+
 /* lua object */
 class Object {
     friend class Variant;
@@ -390,6 +644,8 @@ class UserData;
 
 /* Variant
  * any var load from lua
+ * string is copied, unless loaded by State::GetVariant(index, true):
+ * then the long string refers the lua string (pinned by registry) and is tied to the state
 */
 class Variant {
     friend class State;
@@ -410,6 +666,11 @@ private:
     Variant(void* val) : type_(VarType::kLightUserData), ptr_(val) {}
     Variant(void* ptr, int index, State* s) : type_(VarType::kUserData), ptr_(ptr), obj_(index, s) {}
     Variant(VarType ty, int index, State* s) : type_(ty), obj_(index, s) {}
+    Variant(const char* str, size_t len, int index, State* s)
+        : type_(VarType::kString), ptr_(const_cast<char*>(str)), len_(len), obj_(index, s) {}
+
+    /* the string not longer than this is copied, fit in the small string buffer */
+    static constexpr size_t kCopyStrLen = 15;
 
 public:
     inline bool operator == (const Variant& other) const {
@@ -428,7 +689,8 @@ public:
             } else {
                 return ToDobule() == other.number_;
             }
-        case xlua::VarType::kString: return str_ == other.str_;
+        case xlua::VarType::kString:
+            return StrLen() == other.StrLen() && ::memcmp(ToCStr(), other.ToCStr(), StrLen()) == 0;
         case xlua::VarType::kTable:
         case xlua::VarType::kFunction:
         case xlua::VarType::kUserData:
@@ -471,8 +733,22 @@ public:
     }
 
     inline float ToFloat() const { return static_cast<float>(ToDobule()); }
-    inline const std::string& ToString() const {
-        return (type_ == VarType::kString) ? str_ : std::string();
+    /* the string is valid as long as the variant */
+    inline const char* ToCStr() const {
+        if (type_ != VarType::kString)
+            return nullptr;
+        return obj_.IsValid() ? static_cast<const char*>(ptr_) : str_.c_str();
+    }
+    inline size_t StrLen() const {
+        if (type_ != VarType::kString)
+            return 0;
+        return obj_.IsValid() ? len_ : str_.size();
+    }
+    /* copy the string */
+    inline std::string ToString() const {
+        if (type_ != VarType::kString)
+            return std::string();
+        return obj_.IsValid() ? std::string(static_cast<const char*>(ptr_), len_) : str_;
     }
     /* light user data */
     inline void* ToPtr() const {
@@ -509,6 +785,7 @@ private:
         void* ptr_;
     };
 
+    size_t len_ = 0;        // length of the refered string
     std::string str_;
     Object obj_;
 }; // class Variant
@@ -547,8 +824,8 @@ namespace internal {
             s->Push(obj_);
             s->Push(value_.first);
             if (lua_next(s->GetLuaState(), -2) != 0) {
-                value_.second = s->Get<Variant>(-1);
-                value_.first = s->Get<Variant>(-2);
+                value_.second = s->template Get<Variant>(-1);
+                value_.first = s->template Get<Variant>(-2);
             } else {
                 value_.first = Variant();
             }
@@ -653,6 +930,26 @@ public:
         return CallGuard();
     }
 
+    /* traverse without Variant, fn(const TableCursor&) */
+    template <typename Fn>
+    inline void ForEach(Fn&& fn) const {
+        assert(IsValid());
+
+        StackGuard guard(state_);
+        state_->Push(*this);
+        state_->ForEach(-1, std::forward<Fn>(fn));
+    }
+
+    /* traverse without Variant, fn(Ky key, Vy value) */
+    template <typename Ky, typename Vy, typename Fn>
+    inline void ForEach(Fn&& fn) const {
+        assert(IsValid());
+
+        StackGuard guard(state_);
+        state_->Push(*this);
+        state_->template ForEach<Ky, Vy>(-1, std::forward<Fn>(fn));
+    }
+
 public:
     inline iterator begin() const {
         iterator it(*this);
@@ -843,6 +1140,63 @@ public:
     }
 }; // class Function
 
+namespace internal {
+    template <typename Ty>
+    struct AsyncDataImpl : AsyncData {
+        virtual void PushValue(State* s) override { s->Push(value); }
+
+        template <typename Uy>
+        inline void SetValue(Uy&& val) { value = std::forward<Uy>(val); }
+
+        Ty value;
+    };
+
+    template <>
+    struct AsyncDataImpl<void> : AsyncData {
+        virtual void PushValue(State* s) override { s->PushNil(); }
+
+        inline void SetValue() {}
+    };
+} // namespace internal
+
+/* async result of exported function
+ * exported function return it to yield the calling coroutine,
+ * Resolve/Reject resume the coroutine, must be called at the thread who own the state
+*/
+template <typename Ty>
+class Async {
+public:
+    Async() : data_(std::make_shared<internal::AsyncDataImpl<Ty>>()) {}
+
+public:
+    inline bool IsReady() const { return data_->ready; }
+    inline bool IsWaiting() const { return data_->state != nullptr; }
+    inline const std::shared_ptr<internal::AsyncData>& GetData() const { return data_; }
+
+    template <typename... Args>
+    void Resolve(Args&&... args) {
+        if (data_->ready)
+            return;
+
+        static_cast<internal::AsyncDataImpl<Ty>*>(data_.get())->SetValue(std::forward<Args>(args)...);
+        data_->ready = true;
+        internal::ResumeAsync(data_.get());
+    }
+
+    void Reject(const char* error) {
+        if (data_->ready)
+            return;
+
+        data_->ok = false;
+        data_->error = error ? error : "";
+        data_->ready = true;
+        internal::ResumeAsync(data_.get());
+    }
+
+private:
+    std::shared_ptr<internal::AsyncData> data_;
+}; // class Async
+
 /* variant detail */
 inline Variant::Variant(const Table& table)
     : type_(table.IsValid() ? VarType::kTable : VarType::kNil), obj_(table) {}